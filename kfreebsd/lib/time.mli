@@ -16,6 +16,7 @@
 
 val restart_threads: (unit -> float) -> unit
 val select_next : (unit -> float) -> float option
+val next_deadline : unit -> float option
 val sleep : float -> unit Lwt.t
 val yield : unit -> unit Lwt.t
 
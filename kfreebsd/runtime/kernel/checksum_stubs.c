@@ -28,6 +28,10 @@
 
 CAMLprim value caml_ones_complement_checksum(value v_cstruct);
 CAMLprim value caml_ones_complement_checksum_list(value v_cstruct_list);
+CAMLprim value caml_ones_complement_checksum_copy(value v_dst, value v_src_list);
+CAMLprim value caml_ones_complement_checksum_update16(value v_csum, value v_old, value v_new);
+CAMLprim value caml_ones_complement_checksum_update32(value v_csum, value v_old, value v_new);
+CAMLprim value caml_ones_complement_checksum_list_with(value v_partial, value v_list);
 
 #if !defined(__FreeBSD__) && defined(_KERNEL)
 /* WARNING: This code assumes that it is running on a little endian machine (x86) */
@@ -251,3 +255,126 @@ caml_ones_complement_checksum_list(value v_cstruct_list)
   checksum = htons(~sum64);
   CAMLreturn(Val_int(checksum));
 }
+
+/* Copy a list of cstruct.ts back to back into the cstruct v_dst, and
+ * return the ones complement sum of the bytes copied. The sum is folded
+ * to 16 bits but not complemented, so that the caller can still add in
+ * a pseudo-header before taking the complement. Each word is summed as
+ * it is copied; this stays scalar, since vector registers would need
+ * fpu_kern_enter here. Raises Invalid_argument, before copying
+ * anything, if v_dst is too short. */
+CAMLprim value
+caml_ones_complement_checksum_copy(value v_dst, value v_src_list)
+{
+  CAMLparam2(v_dst, v_src_list);
+  CAMLlocal2(v_list, v_hd);
+  uint16_t overflow_val = 0;
+  uint16_t overflow = 0;
+  size_t count, total = 0;
+  unsigned char *dst, *src;
+  uint64_t sum64 = 0;
+
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1))
+    total += Int_val(Field(Field(v_list, 0), 2));
+  if (total > (size_t) Int_val(Field(v_dst, 2)))
+    caml_invalid_argument("caml_ones_complement_checksum_copy");
+
+  dst = (unsigned char *) Caml_ba_data_val(Field(v_dst, 0)) + Int_val(Field(v_dst, 1));
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1)) {
+    v_hd = Field(v_list, 0);
+    src = (unsigned char *) Caml_ba_data_val(Field(v_hd, 0)) + Int_val(Field(v_hd, 1));
+    count = Int_val(Field(v_hd, 2));
+    if (count <= 0) continue;
+    if (overflow != 0) {
+      *dst++ = *src;
+      overflow_val = ntohs((overflow_val << 8) + (*src++));
+      sum64 += overflow_val;
+      if (sum64 < overflow_val) sum64++;
+      overflow = 0;
+      count--;
+    }
+
+    while (count >= 8) {
+      uint64_t s = *(uint64_t *) src;
+      *(uint64_t *) dst = s;
+      sum64 += s;
+      if (sum64 < s) sum64++;
+      count -= 8;
+      src += 8;
+      dst += 8;
+    }
+
+    while (count > 1) {
+      uint16_t v = *(uint16_t *) src;
+      *(uint16_t *) dst = v;
+      sum64 += v;
+      if (sum64 < v) sum64++;
+      count -= 2;
+      src += 2;
+      dst += 2;
+    }
+
+    if (count > 0) {
+      overflow_val = *dst++ = *src;
+      overflow = 1;
+    }
+  }
+
+  if (overflow != 0) {
+    overflow_val = ntohs(overflow_val << 8);
+    sum64 += overflow_val;
+    if (sum64 < overflow_val) sum64++;
+  }
+
+  while (sum64 >> 16)
+    sum64 = (sum64 & 0xffff) + (sum64 >> 16);
+  CAMLreturn(Val_int(htons(sum64)));
+}
+
+/* Incremental updates, after RFC 1624. Checksums and field values are
+ * passed as read from the packet with Cstruct.BE; the arithmetic does
+ * not depend on byte order as long as it is the same throughout. */
+
+static inline uint16_t
+fold32(uint32_t sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+/* The checksum [csum] after a 16-bit field changed from [old] to [new]:
+ * HC' = ~(~HC + ~m + m'), eqn. 3 of RFC 1624 */
+CAMLprim value
+caml_ones_complement_checksum_update16(value v_csum, value v_old, value v_new)
+{
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~Int_val(v_old);
+  sum += (uint16_t) Int_val(v_new);
+  return Val_int((uint16_t) ~fold32(sum));
+}
+
+/* The same for a 32-bit field, such as an IPv4 address, given as
+ * Int32.ts */
+CAMLprim value
+caml_ones_complement_checksum_update32(value v_csum, value v_old, value v_new)
+{
+  uint32_t old = Int32_val(v_old), new = Int32_val(v_new);
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~(old >> 16) + (uint16_t) ~(old & 0xffff);
+  sum += (new >> 16) + (new & 0xffff);
+  return Val_int((uint16_t) ~fold32(sum));
+}
+
+/* Checksum a list of buffers together with [v_partial], the (folded,
+ * uncomplemented) sum of other data already known, e.g. an unchanged
+ * payload or a pseudo-header. That data must span an even number of
+ * bytes. */
+CAMLprim value
+caml_ones_complement_checksum_list_with(value v_partial, value v_list)
+{
+  uint16_t csum = Int_val(caml_ones_complement_checksum_list(v_list));
+  uint32_t sum = (uint16_t) ~csum;
+  sum += (uint16_t) Int_val(v_partial);
+  return Val_int((uint16_t) ~fold32(sum));
+}
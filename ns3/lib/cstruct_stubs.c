@@ -23,18 +23,20 @@
 #include <caml/alloc.h>
 #include <caml/bigarray.h>
 
+/* Neither function below allocates, so they register no roots and
+ * may be declared "noalloc". */
+
 /* Return the offset of the bigarray slice against the underlying
  * data buffer (which is recorded in the ba->proxy, if it is set */
 CAMLprim value
 caml_bigarray_base_offset(value v_ba)
 {
-  CAMLparam1(v_ba);
   struct caml_ba_array *ba = Caml_ba_array_val(v_ba);
   if (ba->proxy == NULL)
-    CAMLreturn(Val_int(0));
+    return Val_int(0);
   else {
-    off_t len = (ba->data - ba->proxy->data);
-    CAMLreturn(Val_int(len));
+    off_t len = ((char *)ba->data - (char *)ba->proxy->data);
+    return Val_long(len);
   }
 }
 
@@ -44,21 +46,20 @@ caml_bigarray_base_offset(value v_ba)
 CAMLprim value
 caml_bigarray_shift_left(value v_ba, value v_len)
 {
-  CAMLparam2(v_ba, v_len);
   struct caml_ba_array *ba = Caml_ba_array_val(v_ba);
   /* Only supported for 1 dimensional arrays */
   if (ba->num_dims != 1)
-    CAMLreturn(Val_int(0));
+    return Val_int(0);
   /* If there is no proxy, we are already at the base */
   if (ba->proxy == NULL)
-    CAMLreturn(Val_int(0));
-  off_t avail = ba->data - ba->proxy->data;
+    return Val_int(0);
+  off_t avail = (char *)ba->data - (char *)ba->proxy->data;
   off_t len = Int_val(v_len);
   /* Ensure we have header space to shift left */
   if (len > avail)
-    CAMLreturn(Val_int(0));
+    return Val_int(0);
   /* Adjust the data pointer and length of the array */
-  ba->data = ba->data - len;
+  ba->data = (char *)ba->data - len;
   ba->dim[0] = ba->dim[0] + len;
-  CAMLreturn(Val_int(1));
+  return Val_int(1);
 }
@@ -20,22 +20,318 @@
 #include <caml/memory.h>
 #include <caml/fail.h>
 #include <caml/bigarray.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-static uint32_t
-checksum_bigarray(unsigned char *addr, size_t ofs, size_t count, uint32_t sum)
+/* Sums are taken over host-order words and only byte-swapped at the
+   end, which gives the same ones complement checksum */
+static inline uint64_t
+load64(const unsigned char *addr)
 {
-  addr += ofs;
+  uint64_t v;
+  memcpy(&v, addr, sizeof(v));
+  return v;
+}
+
+static inline uint16_t
+load16(const unsigned char *addr)
+{
+  uint16_t v;
+  memcpy(&v, addr, sizeof(v));
+  return v;
+}
+
+/* The 16-bit word made of bytes [hi, lo] in memory order */
+static inline uint16_t
+make16(unsigned char hi, unsigned char lo)
+{
+  unsigned char b[2] = { hi, lo };
+  return load16(b);
+}
+
+static inline uint16_t
+fold_to_net(uint64_t sum64)
+{
+  uint16_t v;
+  while (sum64 >> 16)
+    sum64 = (sum64 & 0xffff) + (sum64 >> 16);
+  v = ~sum64;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return v;
+#else
+  return ((v & 0xFF) << 8) | ((v & 0xFF00) >> 8);
+#endif
+}
+
+static inline uint64_t
+add_carry(uint64_t sum64, uint64_t v)
+{
+  sum64 += v;
+  if (sum64 < v) sum64++;
+  return sum64;
+}
+
+/* The vector kernels below sum 32-bit words into 64-bit lanes, which
+   cannot overflow, and fold them into the end-around-carry sum at the
+   end. All sums are congruent modulo 0xffff, so the folded result is
+   bit-identical to the scalar loop. Each consumes a multiple of its
+   block size and leaves the tail to the caller. */
+
+static uint64_t
+sum_block_scalar(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    sum64 = add_carry(sum64, load64(addr));
+    sum64 = add_carry(sum64, load64(addr + 8));
+    sum64 = add_carry(sum64, load64(addr + 16));
+    sum64 = add_carry(sum64, load64(addr + 24));
+    addr += 32;
+  }
+  return sum64;
+}
+
+/* Same as the above, also copying the bytes summed to dst */
+
+static uint64_t
+copy_sum_block_scalar(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    uint64_t a = load64(src), b = load64(src + 8), c = load64(src + 16), d = load64(src + 24);
+    memcpy(dst, src, 32);
+    sum64 = add_carry(sum64, a);
+    sum64 = add_carry(sum64, b);
+    sum64 = add_carry(sum64, c);
+    sum64 = add_carry(sum64, d);
+    src += 32;
+    dst += 32;
+  }
+  return sum64;
+}
+
+#if defined(__x86_64__)
+static __attribute__((target("sse2"))) uint64_t
+sum_block_sse2(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  uint64_t lanes[2];
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *) addr);
+    __m128i v1 = _mm_loadu_si128((const __m128i *) (addr + 16));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+    addr += 32;
+  }
+  _mm_storeu_si128((__m128i *) lanes, acc0);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  _mm_storeu_si128((__m128i *) lanes, acc1);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  return sum64;
+}
+
+static __attribute__((target("avx2"))) uint64_t
+sum_block_avx2(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  uint64_t lanes[4];
+  size_t n = count / 64;
+  int i;
+  *done = n * 64;
+  while (n-- > 0) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *) addr);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *) (addr + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    addr += 64;
+  }
+  _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+  for (i = 0; i < 4; i++)
+    sum64 = add_carry(sum64, lanes[i]);
+  return sum64;
+}
+
+static __attribute__((target("sse2"))) uint64_t
+copy_sum_block_sse2(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  uint64_t lanes[2];
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *) src);
+    __m128i v1 = _mm_loadu_si128((const __m128i *) (src + 16));
+    _mm_storeu_si128((__m128i *) dst, v0);
+    _mm_storeu_si128((__m128i *) (dst + 16), v1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+    src += 32;
+    dst += 32;
+  }
+  _mm_storeu_si128((__m128i *) lanes, acc0);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  _mm_storeu_si128((__m128i *) lanes, acc1);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  return sum64;
+}
+
+static __attribute__((target("avx2"))) uint64_t
+copy_sum_block_avx2(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  uint64_t lanes[4];
+  size_t n = count / 64;
+  int i;
+  *done = n * 64;
+  while (n-- > 0) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *) src);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *) (src + 32));
+    _mm256_storeu_si256((__m256i *) dst, v0);
+    _mm256_storeu_si256((__m256i *) (dst + 32), v1);
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    src += 64;
+    dst += 64;
+  }
+  _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+  for (i = 0; i < 4; i++)
+    sum64 = add_carry(sum64, lanes[i]);
+  return sum64;
+}
+
+#endif
+
+typedef uint64_t (*sum_block_fn)(const unsigned char *, size_t, uint64_t, size_t *);
+typedef uint64_t (*copy_sum_block_fn)(unsigned char *, const unsigned char *, size_t, uint64_t, size_t *);
+
+static sum_block_fn sum_block = NULL;
+static copy_sum_block_fn copy_sum_block = NULL;
+
+static void
+select_kernels(void)
+{
+#if defined(__x86_64__)
+  uint32_t eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+  __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+  if (eax >= 7) {
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    /* The OS must have enabled the YMM state (OSXSAVE and XCR0) */
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+      __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+      if ((xcr0_lo & 6) == 6) {
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+        if (ebx & (1 << 5)) {
+          copy_sum_block = copy_sum_block_avx2;
+          sum_block = sum_block_avx2;
+          return;
+        }
+      }
+    }
+  }
+  /* SSE2 is part of x86_64 */
+  copy_sum_block = copy_sum_block_sse2;
+  sum_block = sum_block_sse2;
+#else
+  copy_sum_block = copy_sum_block_scalar;
+  sum_block = sum_block_scalar;
+#endif
+}
+
+/* Add the 16-bit words of [addr, addr + count) to sum64, count even */
+static uint64_t
+sum_words(const unsigned char *addr, size_t count, uint64_t sum64)
+{
+  size_t done = 0;
+
+  if (sum_block == NULL)
+    select_kernels();
+  /* Short buffers are not worth the vector setup */
+  if (count >= 128)
+    sum64 = sum_block(addr, count, sum64, &done);
+  else
+    sum64 = sum_block_scalar(addr, count, sum64, &done);
+  addr += done;
+  count -= done;
+
+  while (count >= 8) {
+    sum64 = add_carry(sum64, load64(addr));
+    count -= 8;
+    addr += 8;
+  }
   while (count > 1) {
-    uint16_t v = (*addr << 8) + (*(addr+1));
-    sum += v;
+    sum64 = add_carry(sum64, load16(addr));
     count -= 2;
     addr += 2;
   }
-  if (count > 0)
-    sum += (*(unsigned char *)addr) << 8;
-  while (sum >> 16)
-    sum = (sum & 0xffff) + (sum >> 16);
-  return sum;
+  return sum64;
+}
+
+/* Copy [src, src + count) to dst, adding its 16-bit words to sum64,
+   count even */
+static uint64_t
+copy_sum_words(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64)
+{
+  size_t done = 0;
+
+  if (copy_sum_block == NULL)
+    select_kernels();
+  if (count >= 128)
+    sum64 = copy_sum_block(dst, src, count, sum64, &done);
+  else
+    sum64 = copy_sum_block_scalar(dst, src, count, sum64, &done);
+  dst += done;
+  src += done;
+  count -= done;
+
+  while (count >= 8) {
+    uint64_t v = load64(src);
+    memcpy(dst, src, 8);
+    sum64 = add_carry(sum64, v);
+    count -= 8;
+    src += 8;
+    dst += 8;
+  }
+  while (count > 1) {
+    uint16_t v = load16(src);
+    memcpy(dst, src, 2);
+    sum64 = add_carry(sum64, v);
+    count -= 2;
+    src += 2;
+    dst += 2;
+  }
+  return sum64;
+}
+
+static uint16_t
+checksum_bigarray(unsigned char *addr, size_t count)
+{
+  uint64_t sum64 = sum_words(addr, count & ~(size_t)1, 0);
+  if (count & 1)
+    sum64 = add_carry(sum64, make16(addr[count - 1], 0));
+  return fold_to_net(sum64);
 }
 
 CAMLprim value
@@ -43,13 +339,11 @@ caml_ones_complement_checksum(value v_cstruct)
 {
   CAMLparam1(v_cstruct);
   CAMLlocal3(v_ba, v_ofs, v_len);
-  uint32_t sum = 0;
   uint16_t checksum = 0;
   v_ba = Field(v_cstruct, 0);
   v_ofs = Field(v_cstruct, 1);
   v_len = Field(v_cstruct, 2);
-  sum = checksum_bigarray(Caml_ba_data_val(v_ba), Int_val(v_ofs), Int_val(v_len), 0);
-  checksum = ~sum;
+  checksum = checksum_bigarray((unsigned char *) Caml_ba_data_val(v_ba) + Int_val(v_ofs), Int_val(v_len));
   CAMLreturn(Val_int(checksum));
 }
 
@@ -62,9 +356,9 @@ caml_ones_complement_checksum_list(value v_cstruct_list)
 {
   CAMLparam1(v_cstruct_list);
   CAMLlocal4(v_hd, v_ba, v_ofs, v_len);
-  uint32_t sum = 0;
-  uint16_t checksum = 0;
-  uint16_t overflow = 0;
+  uint64_t sum64 = 0;
+  unsigned char overflow_val = 0;
+  int overflow = 0;
   size_t count = 0;
   struct caml_ba_array *a = NULL;
   unsigned char *addr;
@@ -78,29 +372,117 @@ caml_ones_complement_checksum_list(value v_cstruct_list)
     addr = a->data + Int_val(v_ofs);
     count = Int_val(v_len);
     if (count <= 0) continue;
-    if (overflow != 0) {
-      sum += (overflow << 8) + (*addr);
+    if (overflow) {
+      sum64 = add_carry(sum64, make16(overflow_val, *addr));
       overflow = 0;
       addr++;
       count--;
     }
-    while (count > 1) {
-      uint16_t v = (*addr << 8) + (*(addr+1));
-      sum += v;
-      count -= 2;
-      addr += 2;
+    sum64 = sum_words(addr, count & ~(size_t)1, sum64);
+    addr += count & ~(size_t)1;
+    if (count & 1) {
+      overflow_val = *addr;
+      overflow = 1;
+    }
+  }
+  if (overflow)
+    sum64 = add_carry(sum64, make16(overflow_val, 0));
+  CAMLreturn(Val_int(fold_to_net(sum64)));
+}
+
+/* Copy a list of cstruct.ts back to back into the cstruct v_dst, and
+ * return the ones complement sum of the bytes copied. The sum is folded
+ * to 16 bits but not complemented, so that the caller can still add in
+ * a pseudo-header before taking the complement. Reading and summing
+ * each byte as it is copied saves a second pass over the payload.
+ * Raises Invalid_argument, before copying anything, if v_dst is too
+ * short. */
+CAMLprim value
+caml_ones_complement_checksum_copy(value v_dst, value v_src_list)
+{
+  CAMLparam2(v_dst, v_src_list);
+  CAMLlocal2(v_list, v_hd);
+  unsigned char overflow_val = 0;
+  int overflow = 0;
+  size_t count, total = 0;
+  unsigned char *dst, *src;
+  uint64_t sum64 = 0;
+
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1))
+    total += Int_val(Field(Field(v_list, 0), 2));
+  if (total > (size_t) Int_val(Field(v_dst, 2)))
+    caml_invalid_argument("caml_ones_complement_checksum_copy");
+
+  dst = (unsigned char *) Caml_ba_data_val(Field(v_dst, 0)) + Int_val(Field(v_dst, 1));
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1)) {
+    v_hd = Field(v_list, 0);
+    src = (unsigned char *) Caml_ba_data_val(Field(v_hd, 0)) + Int_val(Field(v_hd, 1));
+    count = Int_val(Field(v_hd, 2));
+    if (count <= 0) continue;
+    if (overflow) {
+      *dst++ = *src;
+      sum64 = add_carry(sum64, make16(overflow_val, *src++));
+      overflow = 0;
+      count--;
     }
-    if (count > 0) {
-      if (v_cstruct_list == Val_emptylist)
-        sum += (*(unsigned char *)addr) << 8;
-      else
-        overflow = *addr;
+    sum64 = copy_sum_words(dst, src, count & ~(size_t)1, sum64);
+    dst += count & ~(size_t)1;
+    src += count & ~(size_t)1;
+    if (count & 1) {
+      overflow_val = *dst++ = *src;
+      overflow = 1;
     }
   }
-  if (overflow != 0)
-    sum += overflow << 8;
-  while (sum >> 16)
-    sum = (sum & 0xffff) + (sum >> 16);
-  checksum = ~sum;
-  CAMLreturn(Val_int(checksum));
+  if (overflow)
+    sum64 = add_carry(sum64, make16(overflow_val, 0));
+  /* fold_to_net complements; undo it to leave the sum open */
+  CAMLreturn(Val_int((uint16_t) ~fold_to_net(sum64)));
+}
+
+/* Incremental updates, after RFC 1624. Checksums and field values are
+ * passed as read from the packet with Cstruct.BE; the arithmetic does
+ * not depend on byte order as long as it is the same throughout. */
+
+static inline uint16_t
+fold32(uint32_t sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+/* The checksum [csum] after a 16-bit field changed from [old] to [new]:
+ * HC' = ~(~HC + ~m + m'), eqn. 3 of RFC 1624 */
+CAMLprim value
+caml_ones_complement_checksum_update16(value v_csum, value v_old, value v_new)
+{
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~Int_val(v_old);
+  sum += (uint16_t) Int_val(v_new);
+  return Val_int((uint16_t) ~fold32(sum));
+}
+
+/* The same for a 32-bit field, such as an IPv4 address, given as
+ * Int32.ts */
+CAMLprim value
+caml_ones_complement_checksum_update32(value v_csum, value v_old, value v_new)
+{
+  uint32_t old = Int32_val(v_old), new = Int32_val(v_new);
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~(old >> 16) + (uint16_t) ~(old & 0xffff);
+  sum += (new >> 16) + (new & 0xffff);
+  return Val_int((uint16_t) ~fold32(sum));
+}
+
+/* Checksum a list of buffers together with [v_partial], the (folded,
+ * uncomplemented) sum of other data already known, e.g. an unchanged
+ * payload or a pseudo-header. That data must span an even number of
+ * bytes. */
+CAMLprim value
+caml_ones_complement_checksum_list_with(value v_partial, value v_list)
+{
+  uint16_t csum = Int_val(caml_ones_complement_checksum_list(v_list));
+  uint32_t sum = (uint16_t) ~csum;
+  sum += (uint16_t) Int_val(v_partial);
+  return Val_int((uint16_t) ~fold32(sum));
 }
@@ -16,38 +16,61 @@
 
 external evtchn_init: unit -> unit = "caml_evtchn_init"
 external evtchn_nr_events: unit -> int = "caml_nr_events"
-external evtchn_test_and_clear: int -> bool = "caml_evtchn_test_and_clear" "noalloc"
+external evtchn_next_pending: unit -> int = "caml_evtchn_next_pending" "noalloc"
+external evtchn_poll: unit -> unit = "caml_evtchn_poll" "noalloc"
 
 let _ = evtchn_init ()
 let nr_events = evtchn_nr_events ()
 let event_cb = Array.init nr_events (fun _ -> Lwt_sequence.create ())
 
+(* Ports which fired while nobody was waiting on them. The next [wait]
+   on such a port returns immediately, otherwise a thread which was busy
+   when its event arrived would miss it and sleep until the next one. *)
+let latched = Array.make nr_events false
+
 (* Block waiting for an event to occur on a particular port *)
 let wait evtchn =
   if Eventchn.is_valid evtchn then begin
 	  let port = Eventchn.to_int evtchn in
-	  let th, u = Lwt.task () in
-	  let node = Lwt_sequence.add_l u event_cb.(port) in
-	  Lwt.on_cancel th (fun _ -> Lwt_sequence.remove node);
-	  th
+	  if latched.(port) then begin
+	    latched.(port) <- false;
+	    Lwt.return ()
+	  end else begin
+	    let th, u = Lwt.task () in
+	    let node = Lwt_sequence.add_l u event_cb.(port) in
+	    Lwt.on_cancel th (fun _ -> Lwt_sequence.remove node);
+	    th
+	  end
   end else Lwt.fail Generation.Invalid
 
-(* Go through the event mask and activate any events, potentially spawning
-   new threads *)
-let run hdl =
-  for port = 0 to nr_events - 1 do
-    (* XXX workaround rare event wedge bug XXX *)
-    if true || evtchn_test_and_clear port then begin
-      Lwt_sequence.iter_node_l (fun node ->
-        let u = Lwt_sequence.get node in
-        Lwt_sequence.remove node;
-        Lwt.wakeup_later u ()
-      ) event_cb.(port)
-    end
-  done
+let wake port =
+  let waiters = event_cb.(port) in
+  if Lwt_sequence.is_empty waiters
+  then latched.(port) <- true
+  else
+    Lwt_sequence.iter_node_l (fun node ->
+      let u = Lwt_sequence.get node in
+      Lwt_sequence.remove node;
+      Lwt.wakeup_later u ()
+    ) waiters
+
+(* Activate the waiters of the ports which fired since the last call,
+   potentially spawning new threads. Only those ports are visited.
+   Returns how many of them there were, whether or not anything was
+   waiting on them. *)
+let run _hdl =
+  evtchn_poll ();
+  let rec loop n =
+    let port = evtchn_next_pending () in
+    if port >= 0 then begin
+      wake port;
+      loop (n + 1)
+    end else n in
+  loop 0
 
 (* Note, this should be run *after* Evtchn.resume *)
 let resume () =
+  Array.fill latched 0 nr_events false;
   for port = 0 to nr_events - 1 do
     Lwt_sequence.iter_node_l (fun node ->
         let u = Lwt_sequence.get node in
@@ -18,14 +18,19 @@
 
 val wait : Eventchn.t -> unit Lwt.t
 (** [wait evtchn] is a cancellable thread that will wake up when
-    [evtchn] is notified. Cancel it if you are no longer interested in
-    waiting on [evtchn]. *)
+    [evtchn] is notified. If [evtchn] was notified while no thread was
+    waiting on it, the first subsequent [wait] returns immediately.
+    Cancel it if you are no longer interested in waiting on
+    [evtchn]. *)
 
 (** {2 Low level interface} *)
 
-val run : Eventchn.handle -> unit
-(** [run ()] goes through the event mask and activate any events,
-    potentially spawning new threads. This function is called by
+val run : Eventchn.handle -> int
+(** [run h] activates the waiters of the event channels notified
+    since the last call, potentially spawning new threads. It returns
+    the number of such channels, counting those with no waiter (whose
+    event is latched for the next {!wait}); this is not the number of
+    threads woken up. [h] is unused. This function is called by
     [Main.run]. Do not call it unless you know what you are doing. *)
 
 val resume : unit -> unit
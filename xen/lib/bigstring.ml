@@ -0,0 +1,107 @@
+(*
+ * Copyright (c) 2013 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *)
+
+type t = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+external get_uint8 : t -> int -> int = "caml_bigstring_get_uint8" "noalloc"
+external set_uint8 : t -> int -> int -> unit = "caml_bigstring_set_uint8" "noalloc"
+
+module LE = struct
+  external get_uint16 : t -> int -> int = "caml_bigstring_get_uint16_le" "noalloc"
+  external set_uint16 : t -> int -> int -> unit = "caml_bigstring_set_uint16_le" "noalloc"
+  external get_uint32 : t -> int -> int = "caml_bigstring_get_uint32_le" "noalloc"
+  external set_uint32 : t -> int -> int -> unit = "caml_bigstring_set_uint32_le" "noalloc"
+  external get_uint64 : t -> int -> int64 = "caml_bigstring_get_uint64_le"
+  external set_uint64 : t -> int -> int64 -> unit = "caml_bigstring_set_uint64_le" "noalloc"
+end
+
+module BE = struct
+  external get_uint16 : t -> int -> int = "caml_bigstring_get_uint16_be" "noalloc"
+  external set_uint16 : t -> int -> int -> unit = "caml_bigstring_set_uint16_be" "noalloc"
+  external get_uint32 : t -> int -> int = "caml_bigstring_get_uint32_be" "noalloc"
+  external set_uint32 : t -> int -> int -> unit = "caml_bigstring_set_uint32_be" "noalloc"
+  external get_uint64 : t -> int -> int64 = "caml_bigstring_get_uint64_be"
+  external set_uint64 : t -> int -> int64 -> unit = "caml_bigstring_set_uint64_be" "noalloc"
+end
+
+external blit : t -> int -> t -> int -> int -> unit = "caml_blit_bigstring_to_bigstring" "noalloc"
+external blit_to_string : t -> int -> string -> int -> int -> unit = "caml_blit_bigstring_to_string" "noalloc"
+external blit_from_string : string -> int -> t -> int -> int -> unit = "caml_blit_string_to_bigstring" "noalloc"
+external fill : t -> int -> int -> char -> unit = "caml_bigstring_fill" "noalloc"
+external compare : t -> int -> t -> int -> int -> int = "caml_bigstring_compare" "noalloc"
+external index : t -> int -> int -> char -> int = "caml_bigstring_index" "noalloc"
+
+module Cs = struct
+  let check fn t off n =
+    if off < 0 || n > t.Cstruct.len - off then invalid_arg fn
+
+  let get_uint8 t off =
+    check "Bigstring.Cs.get_uint8" t off 1;
+    get_uint8 t.Cstruct.buffer (t.Cstruct.off + off)
+
+  let set_uint8 t off v =
+    check "Bigstring.Cs.set_uint8" t off 1;
+    set_uint8 t.Cstruct.buffer (t.Cstruct.off + off) v
+
+  module LE = struct
+    let get_uint16 t off =
+      check "Bigstring.Cs.LE.get_uint16" t off 2;
+      LE.get_uint16 t.Cstruct.buffer (t.Cstruct.off + off)
+
+    let set_uint16 t off v =
+      check "Bigstring.Cs.LE.set_uint16" t off 2;
+      LE.set_uint16 t.Cstruct.buffer (t.Cstruct.off + off) v
+
+    let get_uint32 t off =
+      check "Bigstring.Cs.LE.get_uint32" t off 4;
+      LE.get_uint32 t.Cstruct.buffer (t.Cstruct.off + off)
+
+    let set_uint32 t off v =
+      check "Bigstring.Cs.LE.set_uint32" t off 4;
+      LE.set_uint32 t.Cstruct.buffer (t.Cstruct.off + off) v
+  end
+
+  module BE = struct
+    let get_uint16 t off =
+      check "Bigstring.Cs.BE.get_uint16" t off 2;
+      BE.get_uint16 t.Cstruct.buffer (t.Cstruct.off + off)
+
+    let set_uint16 t off v =
+      check "Bigstring.Cs.BE.set_uint16" t off 2;
+      BE.set_uint16 t.Cstruct.buffer (t.Cstruct.off + off) v
+
+    let get_uint32 t off =
+      check "Bigstring.Cs.BE.get_uint32" t off 4;
+      BE.get_uint32 t.Cstruct.buffer (t.Cstruct.off + off)
+
+    let set_uint32 t off v =
+      check "Bigstring.Cs.BE.set_uint32" t off 4;
+      BE.set_uint32 t.Cstruct.buffer (t.Cstruct.off + off) v
+  end
+
+  let blit src srcoff dst dstoff len =
+    if len < 0 then invalid_arg "Bigstring.Cs.blit";
+    check "Bigstring.Cs.blit" src srcoff len;
+    check "Bigstring.Cs.blit" dst dstoff len;
+    blit src.Cstruct.buffer (src.Cstruct.off + srcoff)
+      dst.Cstruct.buffer (dst.Cstruct.off + dstoff) len
+
+  let fill t c =
+    fill t.Cstruct.buffer t.Cstruct.off t.Cstruct.len c
+
+  external unsafe_load_uint32 : Cstruct.t -> int -> int = "caml_cstruct_unsafe_load_uint32" "noalloc"
+  external unsafe_save_uint32 : Cstruct.t -> int -> int -> unit = "caml_cstruct_unsafe_save_uint32" "noalloc"
+end
@@ -0,0 +1,110 @@
+(*
+ * Copyright (c) 2013 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *)
+
+(** Unchecked primitives on byte bigarrays.
+
+    Each of these is a single C call that neither registers GC roots
+    nor allocates (except the [uint64] loads, which box their result),
+    so they cost little more than an OCaml function call. No bounds
+    checking is done: callers must keep offsets and lengths within
+    the array.
+
+    The [uint32] accessors carry the value in an [int], which is wide
+    enough on 64-bit targets; the upper bits are ignored on stores. *)
+
+type t = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+external get_uint8 : t -> int -> int = "caml_bigstring_get_uint8" "noalloc"
+external set_uint8 : t -> int -> int -> unit = "caml_bigstring_set_uint8" "noalloc"
+
+(** Little-endian accesses. *)
+module LE : sig
+  external get_uint16 : t -> int -> int = "caml_bigstring_get_uint16_le" "noalloc"
+  external set_uint16 : t -> int -> int -> unit = "caml_bigstring_set_uint16_le" "noalloc"
+  external get_uint32 : t -> int -> int = "caml_bigstring_get_uint32_le" "noalloc"
+  external set_uint32 : t -> int -> int -> unit = "caml_bigstring_set_uint32_le" "noalloc"
+  external get_uint64 : t -> int -> int64 = "caml_bigstring_get_uint64_le"
+  external set_uint64 : t -> int -> int64 -> unit = "caml_bigstring_set_uint64_le" "noalloc"
+end
+
+(** Big-endian (network order) accesses. *)
+module BE : sig
+  external get_uint16 : t -> int -> int = "caml_bigstring_get_uint16_be" "noalloc"
+  external set_uint16 : t -> int -> int -> unit = "caml_bigstring_set_uint16_be" "noalloc"
+  external get_uint32 : t -> int -> int = "caml_bigstring_get_uint32_be" "noalloc"
+  external set_uint32 : t -> int -> int -> unit = "caml_bigstring_set_uint32_be" "noalloc"
+  external get_uint64 : t -> int -> int64 = "caml_bigstring_get_uint64_be"
+  external set_uint64 : t -> int -> int64 -> unit = "caml_bigstring_set_uint64_be" "noalloc"
+end
+
+external blit : t -> int -> t -> int -> int -> unit = "caml_blit_bigstring_to_bigstring" "noalloc"
+(** [blit src srcoff dst dstoff len] copies [len] bytes; the ranges
+    may overlap. *)
+
+external blit_to_string : t -> int -> string -> int -> int -> unit = "caml_blit_bigstring_to_string" "noalloc"
+(** [blit_to_string src srcoff dst dstoff len] copies [len] bytes
+    from [src] into the string [dst]. *)
+
+external blit_from_string : string -> int -> t -> int -> int -> unit = "caml_blit_string_to_bigstring" "noalloc"
+(** [blit_from_string src srcoff dst dstoff len] copies [len] bytes
+    from the string [src] into [dst]. *)
+
+external fill : t -> int -> int -> char -> unit = "caml_bigstring_fill" "noalloc"
+(** [fill t off len c] sets [len] bytes of [t] from [off] to [c]. *)
+
+external compare : t -> int -> t -> int -> int -> int = "caml_bigstring_compare" "noalloc"
+(** [compare t1 off1 t2 off2 len] compares two ranges of [len] bytes
+    as unsigned byte strings, returning -1, 0 or 1. *)
+
+external index : t -> int -> int -> char -> int = "caml_bigstring_index" "noalloc"
+(** [index t off len c] is the offset in [t] of the first [c] in the
+    [len] bytes from [off], or -1 if there is none. *)
+
+(** The same accesses on a [Cstruct.t]: offsets are relative to the
+    cstruct and checked against its length, raising [Invalid_argument]
+    as [Cstruct] does, before the unchecked primitive is called. Unlike
+    [Cstruct.BE.get_uint32], the [uint32] loads do not box. *)
+module Cs : sig
+  val get_uint8 : Cstruct.t -> int -> int
+  val set_uint8 : Cstruct.t -> int -> int -> unit
+
+  module LE : sig
+    val get_uint16 : Cstruct.t -> int -> int
+    val set_uint16 : Cstruct.t -> int -> int -> unit
+    val get_uint32 : Cstruct.t -> int -> int
+    val set_uint32 : Cstruct.t -> int -> int -> unit
+  end
+
+  module BE : sig
+    val get_uint16 : Cstruct.t -> int -> int
+    val set_uint16 : Cstruct.t -> int -> int -> unit
+    val get_uint32 : Cstruct.t -> int -> int
+    val set_uint32 : Cstruct.t -> int -> int -> unit
+  end
+
+  val blit : Cstruct.t -> int -> Cstruct.t -> int -> int -> unit
+  (** [blit src srcoff dst dstoff len] is [Cstruct.blit]. *)
+
+  val fill : Cstruct.t -> char -> unit
+  (** [fill t c] sets every byte of [t] to [c]. *)
+
+  external unsafe_load_uint32 : Cstruct.t -> int -> int = "caml_cstruct_unsafe_load_uint32" "noalloc"
+  (** [unsafe_load_uint32 t off] is the native-order 32-bit word at
+      [off] of [t], [off] rounded down to a multiple of 4. Unchecked. *)
+
+  external unsafe_save_uint32 : Cstruct.t -> int -> int -> unit = "caml_cstruct_unsafe_save_uint32" "noalloc"
+  (** [unsafe_save_uint32 t off v] stores [v] the same way. *)
+end
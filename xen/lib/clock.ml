@@ -27,4 +27,6 @@ type tm = {
 }
 
 external time : unit -> float = "unix_gettimeofday"
+external elapsed_ns : unit -> int64 = "caml_clock_elapsed_ns"
+external elapsed_ns_int : unit -> int = "caml_clock_elapsed_ns_int" "noalloc"
 external gmtime : float -> tm = "unix_gmtime"
@@ -34,6 +34,15 @@ val time : unit -> float
 (** Return the current time since 00:00:00 GMT, Jan. 1, 1970, in
     seconds. *)
 
+val elapsed_ns : unit -> int64
+(** [elapsed_ns ()] is a monotonic count of nanoseconds. Unlike
+    {!time} it does not follow changes to the wallclock, and it does
+    not advance while the domain is suspended. *)
+
+external elapsed_ns_int : unit -> int = "caml_clock_elapsed_ns_int" "noalloc"
+(** [elapsed_ns_int ()] is [elapsed_ns ()] as an [int], which does not
+    allocate. *)
+
 val gmtime : float -> tm
 (** Convert a time in seconds, as returned by {!Unix.time}, into a
     date and a time. Assumes UTC (Coordinated Universal Time), also
@@ -36,9 +36,12 @@ module Raw = struct
   external init : unit -> unit = "caml_gnttab_init"
   external fini : unit -> unit = "caml_gnttab_fini"
   external grant_access : gntref -> Io_page.t -> int -> bool -> unit = "caml_gnttab_grant_access"
+  external grant_accessv : gntref array -> Io_page.t -> int -> bool -> unit = "caml_gnttab_grant_accessv"
   external end_access : gntref -> unit = "caml_gnttab_end_access"
   external map_grant : gntref -> Io_page.t -> int -> bool -> grant_handle = "caml_gnttab_map"
   external unmap_grant : grant_handle -> unit = "caml_gnttab_unmap"
+  external mapv_grants : gntref array -> int array -> Io_page.t -> bool -> grant_handle array = "caml_gnttab_mapv"
+  external unmapv_grants : grant_handle array -> unit = "caml_gnttab_unmapv"
 end
 
 module Gnttab = struct
@@ -71,21 +74,16 @@ module Gnttab = struct
   let map () grant writable = try Some (map_exn () grant writable) with _ -> None
 
   let mapv_exn () grants writeable =
-    let nb_grants = List.length grants in
-    let block = Io_page.get nb_grants in
-    let pages = Io_page.to_pages block in
-    let hs =
-      List.fold_left2 (fun acc g p ->
-          try (Raw.map_grant g.ref p g.domid (not writeable))::acc with exn ->
-            List.iter Raw.unmap_grant acc;
-            raise exn
-        )
-        [] grants pages
-    in Local_mapping.make hs block
+    let grants = Array.of_list grants in
+    let block = Io_page.get (Array.length grants) in
+    let refs = Array.map (fun g -> g.ref) grants in
+    let domids = Array.map (fun g -> g.domid) grants in
+    let hs = Raw.mapv_grants refs domids block (not writeable) in
+    Local_mapping.make (Array.to_list hs) block
 
   let mapv () grants writeable = try Some (mapv_exn () grants writeable) with _ -> None
 
-  let unmap_exn () t = List.iter Raw.unmap_grant t.Local_mapping.hs
+  let unmap_exn () t = Raw.unmapv_grants (Array.of_list t.Local_mapping.hs)
 
   let with_mapping interface grant writeable fn =
     let mapping = map interface grant writeable in
@@ -110,62 +108,152 @@ module Gntshr = struct
 		(** Mapping of the shared memory. *)
 	}
 
-  let free_list : gntref Queue.t = Queue.create ()
-  let free_list_waiters = Lwt_sequence.create ()
+  module Quota = struct
+    type t = {
+      name: string;
+      limit: int;
+      mutable in_use: int;
+    }
 
-  let put r =
-    Queue.push r free_list;
-    match Lwt_sequence.take_opt_l free_list_waiters with
-    |None -> ()
-    |Some u -> Lwt.wakeup u ()
+    let create ~name limit =
+      if limit < 1 then invalid_arg "Gntshr.Quota.create";
+      { name; limit; in_use = 0 }
 
-  let num_free_grants () = Queue.length free_list
+    let name t = t.name
+    let limit t = t.limit
+    let in_use t = t.in_use
 
-  let rec get () =
-    match Queue.is_empty free_list with
-    |true ->
+    let allows q n = match q with
+      | None -> true
+      | Some q -> q.in_use + n <= q.limit
+  end
+
+  type quota = Quota.t
+
+  type waiter = {
+    count: int;
+    quota: quota option;
+    wakener: gntref list Lwt.u;
+  }
+
+  (* Free references are kept on a stack, so that a reference which
+     was just released is the next one handed out *)
+  let num_grants () = Raw.nr_entries () - Raw.nr_reserved ()
+  let free_stack = Array.make (Raw.nr_entries ()) 0
+  let nr_free = ref 0
+  let nr_used = ref 0
+  let owner : quota option array = Array.make (Raw.nr_entries ()) None
+  let waiters : waiter Lwt_sequence.t = Lwt_sequence.create ()
+
+  let num_free_grants () = !nr_free
+  let num_used_grants () = !nr_used
+  let num_waiters () = Lwt_sequence.fold_l (fun _ n -> n + 1) waiters 0
+
+  (* Number of references wanted by waiters which only lack free
+     references, rather than room in their own quota. Nobody may
+     overtake them. *)
+  let queued () =
+    Lwt_sequence.fold_l (fun w acc ->
+        if Quota.allows w.quota w.count then acc + w.count else acc
+      ) waiters 0
+
+  let take_n quota n =
+    let rec loop acc = function
+      | 0 -> acc
+      | n ->
+        decr nr_free;
+        let r = free_stack.(!nr_free) in
+        owner.(r) <- quota;
+        loop (r :: acc) (n-1)
+    in
+    nr_used := !nr_used + n;
+    (match quota with Some q -> q.Quota.in_use <- q.Quota.in_use + n | None -> ());
+    List.rev (loop [] n)
+
+  (* Hand references to waiters in FIFO order. A waiter which does not
+     fit in the free references stops the scan, so that large requests
+     are not starved by small ones; a waiter held back by its own quota
+     is skipped, so that it cannot hold up other subsystems. *)
+  let serve () =
+    let ready = ref [] in
+    (try
+       Lwt_sequence.iter_node_l (fun node ->
+           let w = Lwt_sequence.get node in
+           if Quota.allows w.quota w.count then begin
+             if w.count > !nr_free then raise Exit;
+             Lwt_sequence.remove node;
+             ready := (w, take_n w.quota w.count) :: !ready
+           end
+         ) waiters
+     with Exit -> ());
+    List.iter (fun (w, refs) -> Lwt.wakeup w.wakener refs) (List.rev !ready)
+
+  (* Add a fresh reference to the free list, used at startup *)
+  let add_free r =
+    free_stack.(!nr_free) <- r;
+    incr nr_free
+
+  let put r =
+    (match owner.(r) with
+     | Some q -> q.Quota.in_use <- q.Quota.in_use - 1; owner.(r) <- None
+     | None -> ());
+    decr nr_used;
+    add_free r;
+    if not (Lwt_sequence.is_empty waiters) then serve ()
+
+  (* A request which could never be satisfied *)
+  let impossible quota num =
+    num < 0 || num > num_grants () ||
+    (match quota with Some q -> num > q.Quota.limit | None -> false)
+
+  let available quota num =
+    num <= !nr_free - queued () && Quota.allows quota num
+
+  let get_n ?quota num =
+    if impossible quota num then fail (Invalid_argument "Gntshr.get_n")
+    else if available quota num then return (take_n quota num)
+    else begin
       let th, u = Lwt.task () in
-      let node = Lwt_sequence.add_r u free_list_waiters  in
+      let node = Lwt_sequence.add_r { count = num; quota; wakener = u } waiters in
       Lwt.on_cancel th (fun () -> Lwt_sequence.remove node);
-      th >> get ()
-    | false ->
-      return (Queue.pop free_list)
-
-  let get_n num =
-    let rec gen_gnts num acc =
-      match num with
-      |0 -> return acc
-      |n ->
-        lwt gnt = get () in
-        gen_gnts (n-1) (gnt :: acc)
-    in gen_gnts num []
-
-  let get_nonblock () =
-    try Some (Queue.pop free_list) with Queue.Empty -> None
-
-  let get_n_nonblock num =
-    let rec aux acc num = match num with
-      | 0 -> List.rev acc
-      | n ->
-        (match get_nonblock () with
-         | Some p -> aux (p::acc) (n-1)
-         (* If we can't have enough, we push them back in the queue. *)
-         | None -> List.iter (fun gntref -> Queue.push gntref free_list) acc; [])
-    in aux [] num
-
-  let with_ref f =
-    lwt gnt = get () in
+      th
+    end
+
+  let get ?quota () =
+    get_n ?quota 1 >|= List.hd
+
+  let get_n_nonblock ?quota num =
+    if impossible quota num then invalid_arg "Gntshr.get_n_nonblock";
+    if available quota num then take_n quota num else []
+
+  let get_upto_nonblock ?quota num =
+    if num < 0 then invalid_arg "Gntshr.get_upto_nonblock";
+    let room = match quota with
+      | None -> num
+      | Some q -> q.Quota.limit - q.Quota.in_use in
+    take_n quota (max 0 (min num (min room (!nr_free - queued ()))))
+
+  let get_nonblock ?quota () =
+    match get_n_nonblock ?quota 1 with
+    | [r] -> Some r
+    | _ -> None
+
+  let with_ref ?quota f =
+    lwt gnt = get ?quota () in
     try_lwt f gnt
     finally Lwt.return (put gnt)
 
-  let with_refs n f =
-    lwt gnts = get_n n in
+  let with_refs ?quota n f =
+    lwt gnts = get_n ?quota n in
     try_lwt f gnts
     finally Lwt.return (List.iter put gnts)
 
   let grant_access ~domid ~writeable gntref page =
     Raw.grant_access gntref page domid (not writeable)
 
+  let grant_pages ~domid ~writeable gntrefs block =
+    Raw.grant_accessv (Array.of_list gntrefs) block domid (not writeable)
+
   let end_access gntref =
     Raw.end_access gntref
 
@@ -183,14 +271,13 @@ module Gntshr = struct
       Lwt.return (List.iter end_access gnts)
 
   let share_pages_exn interface domid count writeable =
-    (* First allocate a list of n pages. *)
+    (* One contiguous block, granted page by page in a single call *)
     let block = Io_page.get count in
-    let pages = Io_page.to_pages block in
     let gntrefs = get_n_nonblock count in
     if gntrefs = [] then raise Grant_table_full
     else
       begin
-        List.iter2 (fun g p -> grant_access ~domid ~writeable g p) gntrefs pages;
+        grant_pages ~domid ~writeable gntrefs block;
         { refs = gntrefs; mapping = block }
       end
 
@@ -209,8 +296,8 @@ let resume () =
 
 let _ =
     Printf.printf "gnttab_init: %d\n%!" (Raw.nr_entries () - 1);
-    for i = Raw.nr_reserved () to Raw.nr_entries () - 1 do
-        Gntshr.put i;
+    for i = Raw.nr_entries () - 1 downto Raw.nr_reserved () do
+        Gntshr.add_free i;
     done;
     Raw.init ()
 
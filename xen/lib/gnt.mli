@@ -79,7 +79,9 @@ module Gnttab : sig
       mapping from a list of grants that will be writeable if
       [writeable] is [true]. Note the grant list can involve grants
       from multiple domains. If the mapping fails (because at least
-      one grant fails to be mapped), then all grants are unmapped. *)
+      one grant fails to be mapped), then all grants are unmapped.
+      The grants are mapped with a handful of batched hypercalls
+      rather than one per grant. *)
 
   val mapv: interface -> grant list -> bool -> Local_mapping.t option
   (** Like the above but return an option instead of raising an
@@ -141,24 +143,73 @@ module Gntshr : sig
 
   (** {2 Xen specific functions} *)
 
-  val put : gntref -> unit
+  module Quota : sig
+    type t
+    (** A cap on the number of grant references a subsystem may hold
+        at once, so that it cannot starve the others. *)
+
+    val create : name:string -> int -> t
+    (** [create ~name limit] is a quota allowing at most [limit]
+        references to be held at any time. *)
+
+    val name : t -> string
+    val limit : t -> int
+
+    val in_use : t -> int
+    (** [in_use q] is the number of references currently held under
+        [q]. *)
+  end
 
-  val get : unit -> gntref Lwt.t
-  val get_n : int -> gntref list Lwt.t
+  type quota = Quota.t
 
-  val get_nonblock : unit -> gntref option
+  val put : gntref -> unit
+  (** [put gntref] returns [gntref] to the free list, crediting the
+      quota it was allocated under, and hands free references to
+      waiting requests in the order they were made. *)
+
+  val get : ?quota:quota -> unit -> gntref Lwt.t
+
+  val get_n : ?quota:quota -> int -> gntref list Lwt.t
+  (** [get_n ?quota count] is a list of [count] grant references,
+      reserved all at once: a request either receives all of its
+      references or waits for them without holding any. Waiters are
+      served first-come first-served, except that one held back by its
+      own [quota] does not block the others. Fails with
+      [Invalid_argument] if [count] exceeds the table or the quota's
+      limit. *)
+
+  val get_nonblock : ?quota:quota -> unit -> gntref option
   (** [get_nonblock ()] is [Some idx] is the grant table is not full,
       or [None] otherwise. *)
 
-  val get_n_nonblock : int -> gntref list
+  val get_n_nonblock : ?quota:quota -> int -> gntref list
   (** [get_n_nonblock count] is a list of grant table indices of
       length [count], or [[]] if there if the table is too full to
-      accomodate [count] new grant references. *)
+      accomodate [count] new grant references. References already
+      promised to waiting requests are not taken. *)
+
+  val get_upto_nonblock : ?quota:quota -> int -> gntref list
+  (** [get_upto_nonblock ?quota count] is a list of as many grant
+      references as are free, up to [count], and no more than [quota]
+      allows. Like [get_n_nonblock], it does not take references
+      promised to waiting requests. *)
+
+  val num_grants : unit -> int
+  (** [num_grants ()] is the number of grant references which can be
+      allocated, excluding the reserved ones. *)
 
   val num_free_grants : unit -> int
 
-  val with_ref: (gntref -> 'a Lwt.t) -> 'a Lwt.t
-  val with_refs: int -> (gntref list -> 'a Lwt.t) -> 'a Lwt.t
+  val num_used_grants : unit -> int
+  (** [num_used_grants ()] is the number of references currently
+      allocated. *)
+
+  val num_waiters : unit -> int
+  (** [num_waiters ()] is the number of requests blocked in [get] or
+      [get_n]. *)
+
+  val with_ref: ?quota:quota -> (gntref -> 'a Lwt.t) -> 'a Lwt.t
+  val with_refs: ?quota:quota -> int -> (gntref list -> 'a Lwt.t) -> 'a Lwt.t
 
   val grant_access : domid:int -> writeable:bool -> gntref -> Io_page.t -> unit
   (** [grant_access ~domid ~writeable gntref page] adds a grant table
@@ -166,6 +217,12 @@ module Gntshr : sig
       [domid] to read [page], and write to is as well if [writeable] is
       [true]. *)
 
+  val grant_pages : domid:int -> writeable:bool -> gntref list -> Io_page.t -> unit
+  (** [grant_pages ~domid ~writeable gntrefs block] grants page [i] of
+      the contiguous [block] through the [i]th element of [gntrefs], in
+      a single call and without a separate {!Io_page.t} per page.
+      @raise Invalid_argument if [block] has fewer pages than [gntrefs]. *)
+
   val end_access : gntref -> unit
   (** [end_access gntref] removes entry index [gntref] from the grant
       table. *)
@@ -19,6 +19,7 @@
 type t = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
 
 external alloc_pages: int -> t = "caml_alloc_pages"
+external set_gc_budget: int -> unit = "caml_io_page_set_gc_budget"
 
 let page_size = 4096
 
@@ -27,21 +28,25 @@ let get n =
   then raise (Invalid_argument "The number of page should be greater or equal to 1")
   else
     try alloc_pages n with _ ->
-      Gc.compact ();
+      (* Finalise unreachable pages; compacting would not free any
+         more of them and costs far more *)
+      Gc.full_major ();
       try alloc_pages n with _ -> raise Out_of_memory
 
 let get_order order = get (1 lsl order)
 
 let length t = Bigarray.Array1.dim t
 
+let page_count t = length t / page_size
+
+let page t i = Bigarray.Array1.sub t (i * page_size) page_size
+
 let to_pages t =
   if length t mod page_size <> 0
   then raise (Invalid_argument "Argument length should be a multiple of PAGE_SIZE");
-  let rec loop off acc =
-    if off < (length t)
-    then loop (off + page_size) (Bigarray.Array1.sub t off page_size :: acc)
-    else acc in
-  List.rev (loop 0 [])
+  let rec loop i acc =
+    if i < 0 then acc else loop (i - 1) (page t i :: acc) in
+  loop (page_count t - 1) []
 
 let pages n =
   let rec inner acc n = if n > 0 then inner (get 1 :: acc) (n-1) else acc
@@ -52,15 +57,38 @@ let pages_order order = pages (1 lsl order)
 let to_cstruct t = Cstruct.of_bigarray t
 
 let string_blit src srcoff dst dstoff len =
-  for i = srcoff to srcoff + len - 1 do
-    dst.{i+dstoff} <- src.[i]
-  done
+  if srcoff < 0 || dstoff < 0 || len < 0
+    || srcoff > String.length src - len || dstoff > length dst - len
+  then invalid_arg "Io_page.string_blit";
+  Bigstring.blit_from_string src srcoff dst dstoff len
 
 let to_string t =
   let result = String.create (length t) in
-  for i = 0 to length t - 1 do
-    result.[i] <- t.{i}
-  done;
+  Bigstring.blit_to_string t 0 result 0 (length t);
   result
 
 let blit src dest = Bigarray.Array1.blit src dest
+
+module Pool = struct
+  type stats = {
+    free: int;
+    hits: int;
+    misses: int;
+    released: int;
+    low: int;
+    high: int;
+  }
+
+  external max_order: unit -> int = "caml_io_page_pool_max_order"
+  external raw_stats: int -> int array = "caml_io_page_pool_stats"
+  external set_watermarks: int -> int -> int -> unit = "caml_io_page_pool_set_watermarks"
+
+  let max_order = max_order ()
+
+  let stats order =
+    let s = raw_stats order in
+    { free = s.(0); hits = s.(1); misses = s.(2); released = s.(3);
+      low = s.(4); high = s.(5) }
+
+  let set_watermarks ~order ~low ~high = set_watermarks order low high
+end
@@ -24,6 +24,12 @@ val get : int -> t
     pages. If there is not enough memory, the unikernel will
     terminate. *)
 
+val set_gc_budget : int -> unit
+(** [set_gc_budget n] makes the major GC speed up as the memory
+    blocks allocated since its last cycle approach [n] pages, so that
+    unreachable blocks are reclaimed before memory runs out. It
+    defaults to a quarter of the domain's memory. *)
+
 val get_order : int -> t
 (** [get_order i] is [get (1 lsl i)]. *)
 
@@ -43,6 +49,16 @@ val to_pages : t -> t list
 (** [to_pages t] is a list of [size] memory blocks of one page each,
     where [size] is the size of [t] in pages. *)
 
+val page_count : t -> int
+(** [page_count t] is the number of whole pages in [t]. *)
+
+val page : t -> int -> t
+(** [page t i] is page number [i] of [t], sharing its memory. A block
+    from [get n] is physically contiguous, so it can be granted or
+    filled as a whole (see {!Gnt.Gntshr.grant_pages}) and split with
+    [page] only where a separate buffer per page is really needed,
+    instead of allocating [n] single pages with [pages]. *)
+
 val string_blit : string -> int -> t -> int -> int -> unit
 (** [string_blit src srcoff dst dstoff len] copies [len] bytes from
     string [src], starting at byte number [srcoff], to memory block
@@ -50,3 +66,27 @@ val string_blit : string -> int -> t -> int -> int -> unit
 
 val blit : t -> t -> unit
 (** [blit t1 t2] is the same as {!Bigarray.Array1.blit}. *)
+
+(** Blocks of up to [2^Pool.max_order] pages are recycled through
+    per-order free lists instead of the general allocator: [get] takes
+    from them and blocks collected by the GC go back to them. *)
+module Pool : sig
+  type stats = {
+    free: int;      (** blocks currently in the pool *)
+    hits: int;      (** allocations served from the pool *)
+    misses: int;    (** allocations which found the pool empty *)
+    released: int;  (** blocks handed back to the page allocator *)
+    low: int;       (** blocks allocated at once when the pool is empty *)
+    high: int;      (** blocks kept at most *)
+  }
+
+  val max_order : int
+  (** [max_order] is the order of the largest pooled blocks. *)
+
+  val stats : int -> stats
+  (** [stats order] are the counters for blocks of [2^order] pages. *)
+
+  val set_watermarks : order:int -> low:int -> high:int -> unit
+  (** [set_watermarks ~order ~low ~high] sets the watermarks for blocks
+      of [2^order] pages, releasing any blocks above [high]. *)
+end
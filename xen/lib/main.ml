@@ -23,7 +23,22 @@
 
 open Lwt
 
-external block_domain : float -> unit = "caml_block_domain"
+external block_domain : int -> unit = "caml_block_domain" "noalloc"
+external set_busy_poll : int -> unit = "caml_busy_poll_set" "noalloc"
+external busy_poll_counters : unit -> int * int * int * int * int =
+  "caml_busy_poll_stats"
+
+type busy_poll_stats = {
+  polls : int;
+  hits : int;
+  blocks : int;
+  wakeups : int;
+  budget_us : int;
+}
+
+let busy_poll_stats () =
+  let polls, hits, blocks, wakeups, budget_us = busy_poll_counters () in
+  { polls; hits; blocks; wakeups; budget_us }
 
 let evtchn = Eventchn.init ()
 
@@ -45,26 +60,68 @@ let rec call_hooks hooks  =
         in
         call_hooks hooks
 
+(* Scheduler rounds per callback from C: each round wakes paused and
+   sleeping threads, polls the main thread and activates the ports that
+   fired meanwhile. Further rounds only run while ports keep firing. *)
+let batch = ref 1
+
+let set_batch n = batch := max 1 n
+
+type batch_stats = {
+  callbacks : int;
+  rounds : int;
+  max_rounds : int;
+  last_ns : int;
+  max_ns : int;
+}
+
+let callbacks = ref 0
+let rounds = ref 0
+let max_rounds = ref 0
+let last_ns = ref 0
+let max_ns = ref 0
+
+let batch_stats () = {
+  callbacks = !callbacks; rounds = !rounds; max_rounds = !max_rounds;
+  last_ns = !last_ns; max_ns = !max_ns }
+
+let account start n =
+  let ns = Clock.elapsed_ns_int () - start in
+  incr callbacks;
+  rounds := !rounds + n;
+  if n > !max_rounds then max_rounds := n;
+  last_ns := ns;
+  if ns > !max_ns then max_ns := ns
+
 (* Execute one iteration and register a callback function *)
 let run t =
   let t = call_hooks enter_hooks <&> t in
-  let rec aux () =
+  let rec round n =
     Lwt.wakeup_paused ();
-    Time.restart_threads Clock.time;
+    Time.restart_threads Clock.elapsed_ns_int;
+    match Lwt.poll t with
+    | Some x ->
+        true, n
+    | None ->
+        if Activations.run evtchn > 0 && n < !batch then round (n + 1)
+        else false, n in
+  let aux () =
+    let start = Clock.elapsed_ns_int () in
     try
-      match Lwt.poll t with
-      | Some x ->
+      match round 1 with
+      | true, n ->
+          account start n;
           true
-      | None ->
+      | false, n ->
+          account start n;
           (* If we have nothing to do, check for next timeout and
            * and block the domain *)
-          Activations.run evtchn;
-          let timeout =
-            match Time.select_next Clock.time with
-            |None -> 86400000.0
-            |Some tm -> tm
+          let deadline =
+            match Time.next_deadline () with
+            |None -> Clock.elapsed_ns_int () + 86400 * 1_000_000_000
+            |Some ns -> ns
           in
-          block_domain timeout;
+          block_domain deadline;
           false
     with exn ->
       (Printf.printf "Top level exception: %s\n%!" 
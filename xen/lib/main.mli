@@ -16,3 +16,39 @@
 
 val run : unit Lwt.t -> unit
 val at_enter : (unit -> unit Lwt.t) -> unit
+
+(** [set_busy_poll us] lets the domain spin for up to [us] microseconds
+    on the pending bits of its event channels before blocking in the
+    hypervisor. The actual spin adapts to the recent time between
+    going idle and the next event, and stops altogether while that
+    exceeds [us]. [0], the default, always blocks straight away. *)
+val set_busy_poll : int -> unit
+
+type busy_poll_stats = {
+  polls : int;     (** idle periods that began with a spin *)
+  hits : int;      (** events that arrived while spinning *)
+  blocks : int;    (** times the domain blocked in the hypervisor *)
+  wakeups : int;   (** blocks ended by an event rather than a timeout *)
+  budget_us : int; (** current adaptive spin budget *)
+}
+
+(** [busy_poll_stats ()] is a snapshot of the busy-poll counters. *)
+val busy_poll_stats : unit -> busy_poll_stats
+
+(** [set_batch n] lets each scheduler iteration run up to [n] rounds
+    of wakeups, every one picking up the event channels which fired
+    during the previous, before the domain blocks. Under load this
+    drains several ring notifications per iteration. The default, [1],
+    blocks after a single round. *)
+val set_batch : int -> unit
+
+type batch_stats = {
+  callbacks : int;  (** scheduler iterations so far *)
+  rounds : int;     (** rounds run across all of them *)
+  max_rounds : int; (** largest batch seen *)
+  last_ns : int;    (** time spent in the last iteration *)
+  max_ns : int;     (** longest iteration seen *)
+}
+
+(** [batch_stats ()] is a snapshot of the scheduler batch counters. *)
+val batch_stats : unit -> batch_stats
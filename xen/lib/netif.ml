@@ -21,9 +21,7 @@ let allocate_ring ~domid =
 	let page = Io_page.get 1 in
 	let x = Io_page.to_cstruct page in
 	lwt gnt = Gnt.Gntshr.get () in
-	for i = 0 to Cstruct.len x - 1 do
-	  Cstruct.set_uint8 x i 0
-	done;
+	Bigstring.fill page 0 (Io_page.length page) '\000';
 	Gnt.Gntshr.grant_access ~domid ~writeable:true gnt page;
 	return (gnt, x)
 
@@ -48,8 +46,16 @@ module RX = struct
       uint16_t       status
     } as little_endian
 
+    let flag_data_validated = 1
+    let flag_csum_blank = 2
+    let flag_more_data = 4
+    let flag_extra_info = 8
+
+    (* The status is a signed size, negative on error *)
     let read slot =
-      get_resp_id slot, (get_resp_offset slot, get_resp_flags slot, get_resp_status slot)
+      let status = get_resp_status slot in
+      let status = if status > 0x7fff then status - 0x10000 else status in
+      get_resp_id slot, (get_resp_offset slot, get_resp_flags slot, status)
 
     let total_size = max sizeof_req sizeof_resp
     let _ = assert(total_size = 8)
@@ -86,7 +92,10 @@ module TX = struct
       |More_data      (* 4 *)
       |Extra_info     (* 8 *)
 
+    let flag_csum_blank = 1
+    let flag_data_validated = 2
     let flag_more_data = 4
+    let flag_extra_info = 8
 
     let write ~gref ~offset ~flags ~id ~size slot =
       set_req_gref slot gref;
@@ -101,8 +110,12 @@ module TX = struct
       uint16_t       status
     } as little_endian
 
+    (* Status of the responses to extra info slots *)
+    let rsp_null = 1
+
     let read slot =
-      get_resp_id slot, get_resp_status slot
+      let status = get_resp_status slot in
+      get_resp_id slot, (if status > 0x7fff then status - 0x10000 else status)
 
     let total_size = max sizeof_req sizeof_resp
     let _ = assert(total_size = 12)
@@ -110,13 +123,153 @@ module TX = struct
 
   let create (id, domid) =
     let name = sprintf "Netif.TX.%d" id in
-    lwt rx_gnt, buf = allocate_ring ~domid in
+    lwt tx_gnt, buf = allocate_ring ~domid in
     let sring = Ring.Rpc.of_buf ~buf ~idx_size:Proto_64.total_size ~name in
     let fring = Ring.Rpc.Front.init ~sring in
-    let client = Lwt_ring.Front.init string_of_int fring in
-    return (rx_gnt, fring, client)
+    return (tx_gnt, fring)
+end
+
+(* Extra information slot following the first request of a packet on
+   the transmit ring, or its first response on the receive ring *)
+module Extra = struct
+  cstruct extra {
+    uint8_t        ty;
+    uint8_t        flags;
+    uint16_t       gso_size;
+    uint8_t        gso_type;
+    uint8_t        gso_pad;
+    uint16_t       gso_features
+  } as little_endian
+
+  let type_gso = 1
+  let gso_type_tcpv4 = 1
+  let flag_more = 1
+
+  let write_gso ~size slot =
+    set_extra_ty slot type_gso;
+    set_extra_flags slot 0;
+    set_extra_gso_size slot size;
+    set_extra_gso_type slot gso_type_tcpv4;
+    set_extra_gso_pad slot 0;
+    set_extra_gso_features slot 0
+
+  let more slot = get_extra_flags slot land flag_more <> 0
+end
+
+(* Stack of the request ids which are not in flight on a ring *)
+module Free_ids = struct
+
+  type t = {
+    ids: int array;
+    mutable top: int;
+  }
+
+  let create n = { ids = Array.init n (fun i -> i); top = n }
+
+  (* The caller has to make sure an id is available, which is the
+     case whenever the ring has a free request slot *)
+  let take t =
+    t.top <- t.top - 1;
+    t.ids.(t.top)
+
+  let give t id =
+    t.ids.(t.top) <- id;
+    t.top <- t.top + 1
+end
+
+(* Grant references posted for receive, across all interfaces, are
+   capped at half the table so that transmit, the rings and other
+   devices always find some free *)
+let rx_quota =
+  Gnt.Gntshr.Quota.create ~name:"netif-rx" (Gnt.Gntshr.num_grants () / 2)
+
+(* Receive pages which stay granted to the backend across packets.
+   Since we always ask for rx-copy, the backend only ever copies into
+   these pages and the grant can outlive a single request: a page is
+   re-posted on the ring once the packet it carried has been consumed,
+   instead of being ungranted and replaced by a fresh one. *)
+module Rx_pool = struct
+
+  type t = {
+    domid: int;
+    mutable free: (Gnt.gntref * Io_page.t) list;
+    mutable size: int;
+    mutable grants: int; (* grant table entries set up on the RX path *)
+    mutable closed: bool; (* its transport is gone, see [shutdown] *)
+    returned: unit Lwt_condition.t; (* signalled by [put] *)
+  }
+
+  let create ~domid =
+    { domid; free = []; size = 0; grants = 0; closed = false;
+      returned = Lwt_condition.create () }
+
+  let grant t gref page =
+    Gnt.Gntshr.grant_access ~domid:t.domid ~writeable:true gref page;
+    t.grants <- t.grants + 1
+
+  (* Fresh pages are allocated as contiguous blocks of up to this many,
+     which Io_page recycles through its pools, and each block is granted
+     in one call. Bounding the block keeps a page held by the
+     application from pinning much else. *)
+  let block_pages = 1 lsl Io_page.Pool.max_order
+
+  (* Grant a fresh page through each of [grefs] and pass it to [f] *)
+  let grant_fresh t grefs f =
+    let rec loop grefs =
+      if grefs <> [] then begin
+        let rec split n acc = function
+          |gref :: rest when n > 0 -> split (n-1) (gref :: acc) rest
+          |rest -> List.rev acc, rest in
+        let chunk, rest = split block_pages [] grefs in
+        let n = List.length chunk in
+        let block = Io_page.get n in
+        Gnt.Gntshr.grant_pages ~domid:t.domid ~writeable:true chunk block;
+        t.grants <- t.grants + n;
+        ignore (List.fold_left (fun i gref -> f gref (Io_page.page block i); i + 1) 0 chunk);
+        loop rest
+      end in
+    loop grefs
+
+  (* Grant [n] more pages to the backend and add them to the pool *)
+  let grow t n =
+    if n > 0 then
+      lwt grefs = Gnt.Gntshr.get_n ~quota:rx_quota n in
+      grant_fresh t grefs (fun gref page -> t.free <- (gref, page) :: t.free);
+      t.size <- t.size + n;
+      return ()
+    else return ()
+
+  let take t =
+    match t.free with
+    |[] -> None
+    |hd :: tl -> t.free <- tl; Some hd
+
+  let put t ((gref, _) as buf) =
+    if t.closed then Gnt.Gntshr.put gref
+    else begin
+      t.free <- buf :: t.free;
+      Lwt_condition.broadcast t.returned ()
+    end
+
+  (* Give back the references of a disconnected transport's pool. Pages
+     still lent to the application return theirs when released. *)
+  let shutdown t =
+    List.iter (fun (gref, _) -> Gnt.Gntshr.put gref) t.free;
+    t.free <- [];
+    t.size <- 0;
+    t.closed <- true
 end
 
+(* Receive request in flight. There is one per ring slot, allocated
+   with the ring and updated in place when a request is posted. *)
+type rx_buf = {
+  mutable gref: Gnt.gntref;
+  mutable page: Io_page.t;
+  mutable persistent: bool; (* true if [gref] belongs to the rx_pool *)
+}
+
+let no_page = Bigarray.(Array1.create char c_layout 0)
+
 type features = {
   sg: bool;
   gso_tcpv4: bool;
@@ -125,26 +278,50 @@ type features = {
   smart_poll: bool;
 }
 
-type transport = {
-  id: int;
-  backend_id: int;
-  backend: string;
-  mac: Macaddr.t;
+(* A transmit and receive ring pair, with the event channel they share *)
+type queue = {
+  domid: int; (* of the backend *)
   tx_fring: (TX.response,int) Ring.Rpc.Front.t;
-  tx_client: (TX.response,int) Lwt_ring.Front.t;
   tx_gnt: Gnt.gntref;
   tx_mutex: Lwt_mutex.t; (* Held to avoid signalling between fragments *)
+  (* Fragments in flight, indexed by request id: the grant backing each
+     of them and the completion callback of the packet it ends *)
+  tx_ids: Free_ids.t;
+  tx_grefs: Gnt.gntref array;
+  tx_callbacks: (unit -> unit) array;
   rx_fring: (RX.response,int) Ring.Rpc.Front.t;
   rx_client: (RX.response,int) Lwt_ring.Front.t;
-  rx_map: (int, Gnt.gntref * Io_page.t) Hashtbl.t;
+  rx_ids: Free_ids.t;
+  rx_map: rx_buf array; (* indexed by request id *)
+  rx_posted: int array; (* request id at each ring position *)
+  mutable rx_cons: int; (* position of the next response *)
+  (* Packet being received: its fragments so far, in reverse order *)
+  mutable rx_frags: (Cstruct.t * (unit -> unit)) list;
+  mutable rx_more: bool; (* more data slots follow *)
+  mutable rx_extra: bool; (* an extra info slot follows *)
+  mutable rx_csum_blank: bool; (* its transport checksum is to be filled in *)
+  mutable rx_error: int;
+  rx_pool: Rx_pool.t;
+  (* Ungranted pages released by the application, reused on refill *)
+  mutable rx_spare: Io_page.t list;
+  mutable rx_nr_spare: int;
   rx_gnt: Gnt.gntref;
   evtchn: Eventchn.t;
+}
+
+type transport = {
+  id: int;
+  backend_id: int;
+  backend: string;
+  mac: Macaddr.t;
+  queues: queue array;
   features: features;
 }
 
 type t = {
   mutable t: transport;
   mutable resume_fns: (t -> unit Lwt.t) list;
+  mutable rx_pool_size: int;
   l : Lwt_mutex.t;
   c : unit Lwt_condition.t;
 }
@@ -161,36 +338,82 @@ let devices : (id, t) Hashtbl.t = Hashtbl.create 1
 
 let h = Eventchn.init ()
 
-(* Given a VIF ID and backend domid, construct a netfront record for it *)
-let plug_inner id =
-  lwt xsc = Xs.make () in
-  lwt backend_id = Xs.(immediate xsc (fun h -> read h (sprintf "device/vif/%d/backend-id" id))) >|= int_of_string in
-  Console.log (sprintf "Netfront.create: id=%d domid=%d\n%!" id backend_id);
-  (* Allocate a transmit and receive ring, and event channel for them *)
+(* Upper bound on the number of queues negotiated with the backend *)
+let max_queues = ref 1
+
+let set_max_queues n =
+  if n < 1 then invalid_arg "Netif.set_max_queues";
+  max_queues := n
+
+(* Allocate a transmit and receive ring, and event channel for them *)
+let create_queue (id, backend_id) =
   lwt (rx_gnt, rx_fring, rx_client) = RX.create (id, backend_id) in
-  lwt (tx_gnt, tx_fring, tx_client) = TX.create (id, backend_id) in
+  lwt (tx_gnt, tx_fring) = TX.create (id, backend_id) in
   let tx_mutex = Lwt_mutex.create () in
+  let nr_tx = Ring.Rpc.Front.get_free_requests tx_fring in
+  let tx_ids = Free_ids.create nr_tx in
+  let tx_grefs = Array.make nr_tx 0 in
+  let tx_callbacks = Array.make nr_tx ignore in
+  let nr_rx = Ring.Rpc.Front.get_free_requests rx_fring in
+  let rx_ids = Free_ids.create nr_rx in
+  let rx_map = Array.init nr_rx
+    (fun _ -> { gref = 0; page = no_page; persistent = false }) in
+  let rx_posted = Array.make nr_rx 0 in
+  let rx_pool = Rx_pool.create ~domid:backend_id in
   let evtchn = Eventchn.bind_unbound_port h backend_id in
-  let evtchn_port = Eventchn.to_int evtchn in
+  return { domid = backend_id; tx_fring; tx_gnt; tx_mutex; tx_ids; tx_grefs; tx_callbacks;
+    rx_fring; rx_client; rx_ids; rx_map; rx_posted; rx_cons = 0; rx_frags = [];
+    rx_more = false; rx_extra = false; rx_csum_blank = false; rx_error = 0; rx_pool;
+    rx_spare = []; rx_nr_spare = 0; rx_gnt; evtchn }
+
+(* Given a VIF ID and backend domid, construct a netfront record for it *)
+let plug_inner id =
+  lwt xsc = Xs.make () in
   (* Read Xenstore info and set state to Connected *)
   let node = sprintf "device/vif/%d/" id in
-  lwt backend = Xs.(immediate xsc (fun h -> read h (node ^ "backend"))) in
-  lwt mac =
-    Xs.(immediate xsc (fun h -> read h (node ^ "mac"))) 
-    >|= Macaddr.of_string
-    >>= function
-    | None -> Lwt.fail (Failure "invalid mac")
-    | Some m -> return m 
+  lwt (backend_id, backend, mac) =
+    Xs.(immediate xsc (fun h ->
+      read_many h [node ^ "backend-id"; node ^ "backend"; node ^ "mac"])) >>= function
+    | [backend_id; backend; mac] ->
+      begin match Macaddr.of_string mac with
+      | None -> Lwt.fail (Failure "invalid mac")
+      | Some m -> return (int_of_string backend_id, backend, m)
+      end
+    | _ -> assert false
   in
+  Console.log (sprintf "Netfront.create: id=%d domid=%d\n%!" id backend_id);
   printf "MAC: %s\n%!" (Macaddr.to_string mac);
+  (* One ring pair per queue, up to what the backend supports *)
+  lwt backend_queues =
+    try_lwt
+      Xs.(immediate xsc (fun h -> read h (backend ^ "/multi-queue-max-queues")))
+      >|= int_of_string
+    with _ -> return 1 in
+  let nr_queues = max 1 (min !max_queues backend_queues) in
+  lwt queues = Lwt_list.map_s (fun _ -> create_queue (id, backend_id))
+    (Array.to_list (Array.make nr_queues ())) in
+  let queues = Array.of_list queues in
   Xs.(transaction xsc (fun h ->
     let wrfn k v = write h (node ^ k) v in
-    wrfn "tx-ring-ref" (string_of_int tx_gnt) >>
-    wrfn "rx-ring-ref" (string_of_int rx_gnt) >>
-    wrfn "event-channel" (string_of_int (evtchn_port)) >>
+    let write_queue prefix q =
+      wrfn (prefix ^ "tx-ring-ref") (string_of_int q.tx_gnt) >>
+      wrfn (prefix ^ "rx-ring-ref") (string_of_int q.rx_gnt) >>
+      wrfn (prefix ^ "event-channel") (string_of_int (Eventchn.to_int q.evtchn)) in
+    lwt () =
+      if nr_queues = 1
+      then write_queue "" queues.(0)
+      else
+        let rec write_queues i =
+          if i = nr_queues then return ()
+          else
+            write_queue (sprintf "queue-%d/" i) queues.(i) >>
+            write_queues (i + 1) in
+        wrfn "multi-queue-num-queues" (string_of_int nr_queues) >>
+        write_queues 0 in
     wrfn "request-rx-copy" "1" >>
     wrfn "feature-rx-notify" "1" >>
     wrfn "feature-sg" "1" >>
+    wrfn "feature-gso-tcpv4" "1" >>
     wrfn "state" Device_state.(to_string Connected)
   )) >>
   (* Read backend features *)
@@ -202,24 +425,21 @@ let plug_inner id =
         |"1" -> return true
         |_ -> return false
       with exn -> return false in
-    lwt sg = rdfn "sg" in
-    lwt gso_tcpv4 = rdfn "gso-tcpv4" in
-    lwt rx_copy = rdfn "rx-copy" in
-    lwt rx_flip = rdfn "rx-flip" in
-    lwt smart_poll = rdfn "smart-poll" in
-    return { sg; gso_tcpv4; rx_copy; rx_flip; smart_poll }
+    (* In parallel, so that the reads are pipelined on the ring *)
+    Lwt_list.map_p rdfn ["sg"; "gso-tcpv4"; "rx-copy"; "rx-flip"; "smart-poll"] >>= function
+    | [sg; gso_tcpv4; rx_copy; rx_flip; smart_poll] ->
+      return { sg; gso_tcpv4; rx_copy; rx_flip; smart_poll }
+    | _ -> assert false
   )) in
-  let rx_map = Hashtbl.create 1 in
-  Console.log (sprintf " sg:%b gso_tcpv4:%b rx_copy:%b rx_flip:%b smart_poll:%b"
-    features.sg features.gso_tcpv4 features.rx_copy features.rx_flip features.smart_poll);
-  Eventchn.unmask h evtchn;
+  Console.log (sprintf " sg:%b gso_tcpv4:%b rx_copy:%b rx_flip:%b smart_poll:%b queues:%d"
+    features.sg features.gso_tcpv4 features.rx_copy features.rx_flip features.smart_poll nr_queues);
+  Array.iter (fun q -> Eventchn.unmask h q.evtchn) queues;
   (* Register callback activation *)
-  return { id; backend_id; tx_fring; tx_client; tx_gnt; tx_mutex; rx_gnt; rx_fring; rx_client; rx_map;
-    evtchn; mac; backend; features }
+  return { id; backend_id; queues; mac; backend; features }
 
 let plug id =
   lwt transport = plug_inner id in
-  let t = { t=transport; resume_fns=[]; l=Lwt_mutex.create (); c=Lwt_condition.create () } in
+  let t = { t=transport; resume_fns=[]; rx_pool_size=0; l=Lwt_mutex.create (); c=Lwt_condition.create () } in
   Hashtbl.add devices id t;
   return t
 
@@ -228,156 +448,407 @@ let plug id =
 let unplug id =
   Hashtbl.remove devices id
 
-let notify nf () =
-  Eventchn.notify h nf.evtchn
-
-let refill_requests nf =
-  let num = Ring.Rpc.Front.get_free_requests nf.rx_fring in
-  if num > 0 then
-    lwt grefs = Gnt.Gntshr.get_n num in
-    let pages = Io_page.pages num in
-    List.iter
-      (fun (gref, page) ->
-         let id = gref mod (1 lsl 16) in
-         Gnt.Gntshr.grant_access ~domid:nf.backend_id ~writeable:true gref page;
-         Hashtbl.add nf.rx_map id (gref, page);
-         let slot_id = Ring.Rpc.Front.next_req_id nf.rx_fring in
-         let slot = Ring.Rpc.Front.slot nf.rx_fring slot_id in
-         ignore(RX.Proto_64.write ~id ~gref:(Int32.of_int gref) slot)
-      ) (List.combine grefs pages);
-    if Ring.Rpc.Front.push_requests_and_check_notify nf.rx_fring
-    then notify nf ();
-    return ()
-  else return ()
+let notify q () =
+  Eventchn.notify h q.evtchn
+
+(* Post a receive buffer on the next free ring slot *)
+let post_rx_request q ~persistent gref page =
+  let id = Free_ids.take q.rx_ids in
+  let buf = q.rx_map.(id) in
+  buf.gref <- gref;
+  buf.page <- page;
+  buf.persistent <- persistent;
+  let slot_id = Ring.Rpc.Front.next_req_id q.rx_fring in
+  q.rx_posted.(slot_id mod Array.length q.rx_posted) <- id;
+  let slot = Ring.Rpc.Front.slot q.rx_fring slot_id in
+  ignore(RX.Proto_64.write ~id ~gref:(Int32.of_int gref) slot)
+
+(* Post a request for each of [grefs], on spare pages first and then
+   on fresh ones *)
+let post_fresh q grefs =
+  let rec spare = function
+    |gref :: rest when q.rx_spare <> [] ->
+      let page = List.hd q.rx_spare in
+      q.rx_spare <- List.tl q.rx_spare;
+      q.rx_nr_spare <- q.rx_nr_spare - 1;
+      Rx_pool.grant q.rx_pool gref page;
+      post_rx_request q ~persistent:false gref page;
+      spare rest
+    |rest -> rest
+  in
+  Rx_pool.grant_fresh q.rx_pool (spare grefs)
+    (fun gref page -> post_rx_request q ~persistent:false gref page)
+
+(* Keep at most a ring's worth of spare pages, the rest is left to
+   the GC *)
+let rx_spare q page =
+  if q.rx_nr_spare < Array.length q.rx_map then begin
+    q.rx_spare <- page :: q.rx_spare;
+    q.rx_nr_spare <- q.rx_nr_spare + 1
+  end
 
-let rx_poll nf fn =
-  Ring.Rpc.Front.ack_responses nf.rx_fring (fun slot ->
-    let id,(offset,flags,status) = RX.Proto_64.read slot in
-    let gref, page = Hashtbl.find nf.rx_map id in
-    Hashtbl.remove nf.rx_map id;
+let refill_requests q =
+  let num = Ring.Rpc.Front.get_free_requests q.rx_fring in
+  if num > 0 then begin
+    (* Pre-granted pages from the pool first... *)
+    let rec post_pooled n =
+      if n = 0 then 0 else
+        match Rx_pool.take q.rx_pool with
+        |None -> n
+        |Some (gref, page) ->
+          post_rx_request q ~persistent:true gref page;
+          post_pooled (n-1)
+    in
+    let missing = post_pooled num in
+    (* ...and fall back to granting fresh pages when it runs dry, with
+       as many references as are free. Waiting for more here could mean
+       waiting for those of this very ring, which only [rx_poll] gives
+       back. *)
+    if missing > 0 then
+      post_fresh q (Gnt.Gntshr.get_upto_nonblock ~quota:rx_quota missing);
+    if Ring.Rpc.Front.push_requests_and_check_notify q.rx_fring
+    then notify q ()
+  end
+
+(* Wait for the next event of the queue. When no receive request could
+   be posted, none will come for the receive ring, so wait as well for
+   a page to return to the pool or a reference to be freed. *)
+let wait_event q =
+  if Ring.Rpc.Front.get_free_requests q.rx_fring < Array.length q.rx_map
+  then Activations.wait q.evtchn
+  else
+    Lwt.pick [
+      Activations.wait q.evtchn;
+      Lwt_condition.wait q.rx_pool.Rx_pool.returned;
+      (Gnt.Gntshr.get ~quota:rx_quota () >|= fun gref -> post_fresh q [gref]);
+    ]
+
+(* Take back the buffer of request [id], along with the function to
+   call once its contents have been consumed. Unless [lend] is set, the
+   application may keep pages which were not granted persistently. *)
+let rx_take ~lend q id =
+  let buf = q.rx_map.(id) in
+  let gref = buf.gref and page = buf.page in
+  buf.page <- no_page;
+  Free_ids.give q.rx_ids id;
+  if buf.persistent then
+    (* Persistent grants stay active and the page goes back to the pool *)
+    page, (fun () -> Rx_pool.put q.rx_pool (gref, page))
+  else begin
     Gnt.Gntshr.end_access gref;
     Gnt.Gntshr.put gref;
-    match status with
-    |sz when status > 0 ->
-      let packet = Cstruct.sub (Io_page.to_cstruct page) 0 sz in
-      ignore_result (try_lwt fn packet
-        with exn -> return (printf "RX exn %s\n%!" (Printexc.to_string exn)))
-    |err -> printf "RX error %d\n%!" err
+    page, (if lend then (fun () -> rx_spare q page) else ignore)
+  end
+
+external checksum_list_with : int -> Cstruct.t list -> int =
+  "caml_ones_complement_checksum_list_with"
+
+(* Complete the TCP or UDP checksum of an IPv4 frame the backend left
+   blank (as GSO and local frames are, since we advertise GSO): only
+   the pseudo-header sum may be in the field, so it is computed again
+   in full. Frames of other protocols are left as they are. *)
+let fill_checksum frame =
+  try
+    if Bigstring.Cs.BE.get_uint16 frame 12 = 0x0800 then begin
+      let ihl = (Bigstring.Cs.get_uint8 frame 14 land 0xf) * 4 in
+      let proto = Bigstring.Cs.get_uint8 frame 23 in
+      let len = Bigstring.Cs.BE.get_uint16 frame 16 - ihl in
+      let field = match proto with 6 -> 16 | 17 -> 6 | _ -> -1 in
+      if field >= 0 && len >= field + 2 then begin
+        let segment = Cstruct.sub frame (14 + ihl) len in
+        let word off = Bigstring.Cs.BE.get_uint16 frame off in
+        let fold x = (x land 0xffff) + (x lsr 16) in
+        let pseudo =
+          fold (fold (word 26 + word 28 + word 30 + word 32 + proto + len)) in
+        Bigstring.Cs.BE.set_uint16 segment field 0;
+        let csum = checksum_list_with pseudo [segment] in
+        (* A zero UDP checksum means none *)
+        Bigstring.Cs.BE.set_uint16 segment field
+          (if csum = 0 && proto = 17 then 0xffff else csum)
+      end
+    end
+  with Invalid_argument _ -> ()
+
+(* Hand the packet made of the fragments received so far to [deliver] *)
+let rx_deliver q deliver =
+  let frags = List.rev q.rx_frags in
+  let error = q.rx_error and csum_blank = q.rx_csum_blank in
+  q.rx_frags <- [];
+  q.rx_error <- 0;
+  q.rx_csum_blank <- false;
+  let recycle () = List.iter (fun (_, recycle) -> recycle ()) frags in
+  let deliver packet recycle =
+    if csum_blank then fill_checksum packet;
+    deliver packet recycle in
+  match frags with
+  |_ when error <> 0 ->
+    recycle ();
+    Console.log (sprintf "Netif: RX error %d" error)
+  |[] -> ()
+  |[packet, recycle] -> deliver packet recycle
+  |_ ->
+    (* A large (e.g. GSO) packet spread over several slots is copied
+       into contiguous pages *)
+    let len = Cstruct.lenv (List.map fst frags) in
+    if len = 0 then recycle ()
+    else begin
+      let buf = Io_page.to_cstruct (Io_page.get ((len + 4095) / 4096)) in
+      ignore (List.fold_left (fun off (frag, _) ->
+        Bigstring.Cs.blit frag 0 buf off (Cstruct.len frag);
+        off + Cstruct.len frag) 0 frags);
+      recycle ();
+      deliver (Cstruct.sub buf 0 len) ignore
+    end
+
+let rx_poll ~lend q deliver =
+  let nr_rx = Array.length q.rx_posted in
+  Ring.Rpc.Front.ack_responses q.rx_fring (fun slot ->
+    let pos = q.rx_cons mod nr_rx in
+    q.rx_cons <- q.rx_cons + 1;
+    if q.rx_extra then begin
+      (* The slot carries extra information about the packet (e.g. its
+         GSO type) instead of data. The request it used up is not named
+         in it, but responses come in the order requests were posted. *)
+      let _, recycle = rx_take ~lend:true q q.rx_posted.(pos) in
+      recycle ();
+      q.rx_extra <- Extra.more slot
+    end else begin
+      let id,(offset,flags,status) = RX.Proto_64.read slot in
+      let page, recycle = rx_take ~lend q id in
+      (* Only the first slot of a packet carries its checksum flags *)
+      if not q.rx_more then
+        q.rx_csum_blank <- flags land RX.Proto_64.flag_csum_blank <> 0;
+      if status < 0 then begin
+        recycle ();
+        q.rx_error <- status
+      end else
+        q.rx_frags <-
+          (Cstruct.sub (Io_page.to_cstruct page) offset status, recycle) :: q.rx_frags;
+      q.rx_more <- flags land RX.Proto_64.flag_more_data <> 0;
+      q.rx_extra <- flags land RX.Proto_64.flag_extra_info <> 0
+    end;
+    if not (q.rx_more || q.rx_extra) then rx_deliver q deliver
   )
 
-let tx_poll nf =
-  Lwt_ring.Front.poll nf.tx_client TX.Proto_64.read
-
-(* Push a single page to the ring, but no event notification *)
-let write_request ?size ~flags nf page =
-  lwt gref = Gnt.Gntshr.get () in
-  (* This grants access to the *base* data pointer of the page *)
-  (* XXX: another place where we peek inside the cstruct *)
-  Gnt.Gntshr.grant_access ~domid:nf.t.backend_id ~writeable:false gref page.Cstruct.buffer;
-  let size = match size with |None -> Cstruct.len page |Some s -> s in
-  (* XXX: another place where we peek inside the cstruct *)
-  let offset = page.Cstruct.off in
-  lwt replied = Lwt_ring.Front.write nf.t.tx_client
-    (TX.Proto_64.write ~id:gref ~gref:(Int32.of_int gref) ~offset ~flags ~size) in
-  (* request has been written; when replied returns we have a reply *)
-  let replied =
-    try_lwt
-      lwt _ = replied in
-      Gnt.Gntshr.end_access gref;
-      Gnt.Gntshr.put gref;
-      return ()
-    with Lwt_ring.Shutdown ->
-      Gnt.Gntshr.put gref;
-      fail Lwt_ring.Shutdown
-    | e ->
+(* Reclaim, in a single pass over the responses, the grants of all the
+   fragments the backend is done with *)
+let tx_poll q =
+  Ring.Rpc.Front.ack_responses q.tx_fring (fun slot ->
+    let id, status = TX.Proto_64.read slot in
+    (* Extra info slots only take up a response, without a valid id *)
+    if status <> TX.Proto_64.rsp_null then begin
+      let gref = q.tx_grefs.(id) in
+      let callback = q.tx_callbacks.(id) in
+      q.tx_callbacks.(id) <- ignore;
+      Free_ids.give q.tx_ids id;
       Gnt.Gntshr.end_access gref;
       Gnt.Gntshr.put gref;
-      fail e in
-  return replied
- 
-(* Transmit a packet from buffer, with offset and length *)  
-let rec write_already_locked nf page =
-  try_lwt
-    lwt th = write_request ~flags:0 nf page in
-    Lwt_ring.Front.push nf.t.tx_client (notify nf.t);
-    lwt () = th in
-    (* all fragments acknowledged, resources cleaned up *)
-    return ()
-  with | Lwt_ring.Shutdown -> write_already_locked nf page
-
-let write nf page =
-  Lwt_mutex.with_lock nf.t.tx_mutex
-  (fun () ->
-    write_already_locked nf page
+      callback ()
+    end
   )
 
-(* Transmit a packet from a list of pages *)
-let writev nf pages =
-  Lwt_mutex.with_lock nf.t.tx_mutex
-  (fun () ->
-  let rec wait_for_free_tx n =
-    let numfree = Ring.Rpc.Front.get_free_requests nf.t.tx_fring in 
-    if n >= numfree then 
-      Activations.wait nf.t.evtchn >> 
-      wait_for_free_tx n
-    else
-      return ()
+(* The grant table does not survive a resume, so the fragments still in
+   flight on a disconnected transport only need their references back *)
+let tx_shutdown q =
+  let nr_tx = Array.length q.tx_grefs in
+  let in_flight = Array.make nr_tx true in
+  for i = 0 to q.tx_ids.Free_ids.top - 1 do
+    in_flight.(q.tx_ids.Free_ids.ids.(i)) <- false
+  done;
+  Array.iteri (fun id busy ->
+    if busy then begin
+      let callback = q.tx_callbacks.(id) in
+      q.tx_callbacks.(id) <- ignore;
+      Free_ids.give q.tx_ids id;
+      Gnt.Gntshr.put q.tx_grefs.(id);
+      callback ()
+    end
+  ) in_flight
+
+(* Likewise for the pages still posted for receive and the pool *)
+let rx_shutdown q =
+  Array.iter (fun buf ->
+    if buf.page != no_page then begin
+      Gnt.Gntshr.put buf.gref;
+      buf.page <- no_page
+    end
+  ) q.rx_map;
+  Rx_pool.shutdown q.rx_pool
+
+(* Push a single fragment to the ring, but no event notification. The
+   caller must have checked that a request slot is free. *)
+let write_request ?size ?(callback=ignore) ~flags q page =
+  let push gref =
+    (* This grants access to the *base* data pointer of the page *)
+    (* XXX: another place where we peek inside the cstruct *)
+    Gnt.Gntshr.grant_access ~domid:q.domid ~writeable:false gref page.Cstruct.buffer;
+    let size = match size with |None -> Cstruct.len page |Some s -> s in
+    (* XXX: another place where we peek inside the cstruct *)
+    let offset = page.Cstruct.off in
+    let id = Free_ids.take q.tx_ids in
+    q.tx_grefs.(id) <- gref;
+    q.tx_callbacks.(id) <- callback;
+    let slot_id = Ring.Rpc.Front.next_req_id q.tx_fring in
+    let slot = Ring.Rpc.Front.slot q.tx_fring slot_id in
+    ignore(TX.Proto_64.write ~id ~gref:(Int32.of_int gref) ~offset ~flags ~size slot)
+  in
+  match Gnt.Gntshr.get_nonblock () with
+  |Some gref -> push gref; return ()
+  |None -> Gnt.Gntshr.get () >|= push
+
+(* Wait until [n] request slots are free, reclaiming completed
+   fragments ourselves rather than relying on [listen] to do it *)
+let rec wait_for_free_tx q n =
+  if Ring.Rpc.Front.get_free_requests q.tx_fring >= n then return ()
+  else begin
+    tx_poll q;
+    if Ring.Rpc.Front.get_free_requests q.tx_fring >= n then return ()
+    else Activations.wait q.evtchn >> wait_for_free_tx q n
+  end
+
+(* Push the GSO information of the packet whose first request was just
+   written *)
+let write_gso_extra q size =
+  let slot_id = Ring.Rpc.Front.next_req_id q.tx_fring in
+  let slot = Ring.Rpc.Front.slot q.tx_fring slot_id in
+  Extra.write_gso ~size slot
+
+let writev_already_locked ?callback ?gso_size ~csum_blank q pages =
+  let extra = match gso_size with None -> 0 | Some _ -> 1 in
+  lwt () = wait_for_free_tx q (List.length pages + extra) in
+  (* The backend completes the checksum of GSO packets *)
+  let csum_flags =
+    if csum_blank || extra = 1
+    then TX.Proto_64.(flag_csum_blank lor flag_data_validated)
+    else 0 in
+  let more = function [] -> 0 | _ -> TX.Proto_64.flag_more_data in
+  let last rest = match rest with [] -> callback | _ -> None in
+  let rec xmit = function
+    |[] -> return ()
+    |page :: rest ->
+      write_request ?callback:(last rest) ~flags:(more rest) q page >>
+      xmit rest
   in
-  let numneeded = List.length pages in
-  wait_for_free_tx numneeded >>
   match pages with
   |[] -> return ()
-  |[page] ->
-     (* If there is only one page, then just write it normally *)
-     write_already_locked nf page
-  |first_page::other_pages ->
-     (* For Xen Netfront, the first fragment contains the entire packet
-      * length, which is the backend will use to consume the remaining
-      * fragments until the full length is satisfied *)
-     let size = Cstruct.lenv pages in
-     lwt first_th = write_request ~flags:TX.Proto_64.flag_more_data ~size nf first_page in
-     let rec xmit = function
-       | [] -> return []
-       | hd :: [] ->
-         lwt th = write_request ~flags:0 nf hd in
-         return [ th ]
-       | hd :: tl ->
-         lwt next_th = write_request ~flags:TX.Proto_64.flag_more_data nf hd in
-         lwt rest = xmit tl in
-         return (next_th :: rest) in
-     lwt rest_th = xmit other_pages in
-     (* All fragments are now written, we can now notify the backend *)
-     Lwt_ring.Front.push nf.t.tx_client (notify nf.t);
-     return ()
-  )
+  |first :: rest ->
+    (* For Xen Netfront, the first fragment contains the entire packet
+     * length, which is the backend will use to consume the remaining
+     * fragments until the full length is satisfied *)
+    let flags = csum_flags lor more rest
+      lor (if extra = 1 then TX.Proto_64.flag_extra_info else 0) in
+    lwt () = write_request ~size:(Cstruct.lenv pages) ?callback:(last rest) ~flags q first in
+    (match gso_size with Some size -> write_gso_extra q size | None -> ());
+    lwt () = xmit rest in
+    (* All fragments are now written, we can now notify the backend *)
+    if Ring.Rpc.Front.push_requests_and_check_notify q.tx_fring
+    then notify q ();
+    return ()
 
 let wait_for_plug nf =
 	Console.log_s "Wait for plug..." >>
 	Lwt_mutex.with_lock nf.l (fun () ->
-		while_lwt not (Eventchn.is_valid nf.t.evtchn) do
+		while_lwt not (Eventchn.is_valid nf.t.queues.(0).evtchn) do
 			Lwt_condition.wait ~mutex:nf.l nf.c
 		done)
 
-let listen nf fn =
-  (* Listen for the activation to poll the interface *)
-  let rec poll_t t =
-    lwt () = refill_requests t in
-    rx_poll t fn;
-    tx_poll t;
-    (* Evtchn.notify nf.t.evtchn; *)
-    lwt new_t =
+(* Pick the transmit queue of a frame by hashing its IPv4 addresses and
+   TCP/UDP ports, so that the packets of a flow are never reordered *)
+let select_queue t frame =
+  let nr_queues = Array.length t.queues in
+  if nr_queues = 1 then t.queues.(0)
+  else
+    let hash =
+      try
+        if Bigstring.Cs.BE.get_uint16 frame 12 <> 0x0800 then 0
+        else
+          let ihl = (Bigstring.Cs.get_uint8 frame 14 land 0xf) * 4 in
+          let proto = Bigstring.Cs.get_uint8 frame 23 in
+          let addrs =
+            Bigstring.Cs.BE.get_uint32 frame 26 lxor
+            Bigstring.Cs.BE.get_uint32 frame 30 in
+          let ports =
+            if proto = 6 || proto = 17
+            then Bigstring.Cs.BE.get_uint32 frame (14 + ihl)
+            else 0 in
+          let h = addrs lxor ports lxor proto in
+          h lxor (h lsr 16)
+      with Invalid_argument _ -> 0 in
+    t.queues.((hash land max_int) mod nr_queues)
+
+(* Transmit a packet from a list of pages. This returns as soon as the
+   packet is on the ring: fragments are reclaimed later by [tx_poll],
+   which calls [callback] once the backend has consumed the packet. *)
+let rec writev ?callback ?(csum_blank=false) ?gso_size nf pages =
+  match pages with
+  |[] -> return ()
+  |first :: _ ->
+    if gso_size <> None && not nf.t.features.gso_tcpv4
+    then fail (Invalid_argument "Netif.writev: backend does not support GSO")
+    else
+      let q = select_queue nf.t first in
       try_lwt
-        Activations.wait t.evtchn >> return t
-      with
-      | Generation.Invalid ->
-        Console.log_s "Waiting for plug in listen" >>
+        Lwt_mutex.with_lock q.tx_mutex
+          (fun () -> writev_already_locked ?callback ?gso_size ~csum_blank q pages)
+      with Generation.Invalid ->
         wait_for_plug nf >>
-        Console.log_s "Done..." >>
-        return nf.t
-    in poll_t new_t
+        writev ?callback ~csum_blank ?gso_size nf pages
+
+let write ?callback ?csum_blank ?gso_size nf page =
+  writev ?callback ?csum_blank ?gso_size nf [page]
+
+let poll_queues ~lend nf deliver =
+  (* Listen for the activation to poll a queue, until its transport
+     is disconnected *)
+  let rec poll_q q =
+    refill_requests q;
+    rx_poll ~lend q deliver;
+    tx_poll q;
+    lwt connected =
+      try_lwt
+        wait_event q >> return true
+      with Generation.Invalid -> return false in
+    if connected then poll_q q else return ()
+  in
+  (* The queues are polled independently, and all of them again when
+     the interface is plugged back *)
+  let rec poll_t t =
+    lwt () = Lwt.join (Array.to_list (Array.map poll_q t.queues)) in
+    Console.log_s "Waiting for plug in listen" >>
+    wait_for_plug nf >>
+    Console.log_s "Done..." >>
+    poll_t nf.t
   in
   poll_t nf.t
 
+let listen nf fn =
+  poll_queues ~lend:false nf (fun packet recycle ->
+    ignore_result (try_lwt fn packet
+      with exn -> return (printf "RX exn %s\n%!" (Printexc.to_string exn))
+      finally return (recycle ())))
+
+module Rx_buffer = struct
+  type t = {
+    data: Cstruct.t;
+    mutable release: unit -> unit;
+  }
+
+  let data t = t.data
+
+  let release t =
+    let release = t.release in
+    t.release <- ignore;
+    release ()
+end
+
+let listen_buffers nf fn =
+  poll_queues ~lend:true nf (fun data release ->
+    let buf = { Rx_buffer.data; release } in
+    ignore_result (try_lwt fn buf
+      with exn ->
+        Rx_buffer.release buf;
+        return (printf "RX exn %s\n%!" (Printexc.to_string exn))))
+
 (** Return a list of valid VIFs *)
 let enumerate () =
   Xs.make () >>= fun xsc ->
@@ -387,12 +858,17 @@ let enumerate () =
 
 let resume (id,t) =
   lwt transport = plug_inner id in
+  lwt () = Lwt_list.iter_s (fun q -> Rx_pool.grow q.rx_pool t.rx_pool_size)
+    (Array.to_list transport.queues) in
   let old_transport = t.t in
   t.t <- transport;
   lwt () = Lwt_list.iter_s (fun fn -> fn t) t.resume_fns in
   lwt () = Lwt_mutex.with_lock t.l (fun () -> Lwt_condition.broadcast t.c (); return ()) in
-  Lwt_ring.Front.shutdown old_transport.rx_client;
-  Lwt_ring.Front.shutdown old_transport.tx_client;
+  Array.iter (fun q ->
+    Lwt_ring.Front.shutdown q.rx_client;
+    tx_shutdown q;
+    rx_shutdown q
+  ) old_transport.queues;
   return ()
 
 let resume () =
@@ -402,6 +878,17 @@ let resume () =
 let add_resume_hook t fn =
 	t.resume_fns <- fn::t.resume_fns
 
+let enable_persistent_rx nf n =
+  let extra = n - nf.rx_pool_size in
+  if extra > 0 then begin
+    nf.rx_pool_size <- n;
+    Lwt_list.iter_s (fun q -> Rx_pool.grow q.rx_pool extra)
+      (Array.to_list nf.t.queues)
+  end else return ()
+
+let rx_grants nf =
+  Array.fold_left (fun acc q -> acc + q.rx_pool.Rx_pool.grants) 0 nf.t.queues
+
 (* Type of callback functions for [create]. *)
 type callback = id -> t -> unit Lwt.t
 
@@ -414,6 +901,8 @@ let create () =
 (* The Xenstore MAC address is colon separated, very helpfully *)
 let mac nf = nf.t.mac
 
+let gso_tcpv4 nf = nf.t.features.gso_tcpv4
+
 (* Get write buffer for Netif output *)
 let get_writebuf t =
   let page = Io_page.get 1 in
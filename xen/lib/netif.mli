@@ -30,6 +30,15 @@ val create : unit -> t list Lwt.t
 (** [create ()] is a thread that returns a list of initialized
     netfront interfaces, one per detected netfront. *)
 
+val set_max_queues : int -> unit
+(** [set_max_queues n] allows netfronts plugged from now on to
+    negotiate up to [n] queues with backends supporting
+    [feature-multi-queue]. Each queue has its own pair of rings and
+    event channel; transmitted frames are spread over queues by
+    hashing their flow, and {!listen} polls every queue
+    independently. Defaults to 1 (single queue).
+    @raise Invalid_argument if [n < 1]. *)
+
 val id : t -> id
 (** [id nf] is the id of the netfront [nf]. *)
 
@@ -37,20 +46,72 @@ val backend_id : t -> id
 (** [backend_id nf] is the domid of the netback connected to the
     netfront [nf]. *)
 
-val write : t -> Cstruct.t -> unit Lwt.t
-(** [write nf buf] outputs [buf] to netfront [nf]. *)
+val write : ?callback:(unit -> unit) -> ?csum_blank:bool -> ?gso_size:int ->
+  t -> Cstruct.t -> unit Lwt.t
+(** [write nf buf] outputs [buf] to netfront [nf]. The thread returns
+    as soon as [buf] is queued on the transmit ring, and [buf] must
+    not be modified until the backend has consumed it, which is
+    signalled by calling [callback] (it must not raise).
+
+    If [csum_blank] is [true], the TCP or UDP checksum field of the
+    frame only holds the folded (not complemented) sum of the
+    pseudo-header, and the backend or the NIC completes it.
+
+    If [gso_size] is given, the frame is a large IPv4 TCP segment which
+    the backend splits into segments of [gso_size] bytes of payload;
+    this implies [csum_blank]. Fails with [Invalid_argument] unless
+    {!gso_tcpv4} holds. *)
 
-val writev : t -> Cstruct.t list -> unit Lwt.t
+val writev : ?callback:(unit -> unit) -> ?csum_blank:bool -> ?gso_size:int ->
+  t -> Cstruct.t list -> unit Lwt.t
 (** [writev nf bufs] output a list of buffers to netfront [nf] as a
-    single packet. *)
+    single packet. As for {!write}, the thread returns once the
+    packet is queued, and [callback] is called when the backend has
+    consumed all of [bufs]. *)
 
 val listen : t -> (Cstruct.t -> unit Lwt.t) -> unit Lwt.t
 (** [listen nf cb] is a thread that listens endlesses on [nf], and
-    invoke the callback function as frames are received. *)
+    invoke the callback function as frames are received. If
+    persistent RX grants are enabled (see {!enable_persistent_rx}),
+    a frame received in a pooled page is only valid until the thread
+    returned by [cb] terminates: copy it if it has to be kept.
+
+    Large frames (e.g. coalesced by the backend with GSO) which span
+    several ring slots are reassembled before being passed to [cb].
+    The backend may leave the transport checksum of GSO frames and of
+    frames from local domains blank. For TCP and UDP over IPv4, the
+    only checksum offload we accept, it is filled in before the frame
+    is passed to [cb]. *)
+
+(** Received frames lent to the application by {!listen_buffers}. *)
+module Rx_buffer : sig
+  type t
+  (** A received frame, along with the netfront page holding it. *)
+
+  val data : t -> Cstruct.t
+  (** [data buf] is the frame. It is only valid until [buf] is
+      released. *)
+
+  val release : t -> unit
+  (** [release buf] gives the page of [buf] back to the netfront, which
+      reuses it for the next receive requests. Releasing a buffer more
+      than once has no effect. *)
+end
+
+val listen_buffers : t -> (Rx_buffer.t -> unit Lwt.t) -> unit Lwt.t
+(** [listen_buffers nf cb] is like [listen nf cb], except that the
+    callback owns each frame it receives, and can keep it (e.g. in a
+    reassembly queue) until it calls {!Rx_buffer.release}. Released
+    pages are posted again on the receive ring instead of allocating
+    new ones. If [cb] fails, the buffer is released. *)
 
 val mac : t -> Macaddr.t
 (** [mac nf] is the MAC address of [nf]. *)
 
+val gso_tcpv4 : t -> bool
+(** [gso_tcpv4 nf] is [true] if the backend of [nf] accepts large TCP
+    segments over IPv4, see the [gso_size] argument of {!write}. *)
+
 val get_writebuf : t -> Cstruct.t Lwt.t
 
 val resume : unit -> unit Lwt.t
@@ -59,6 +120,19 @@ val resume : unit -> unit Lwt.t
     is already added as a resume hook for the [Sched.suspend]
     function. *)
 
+val enable_persistent_rx : t -> int -> unit Lwt.t
+(** [enable_persistent_rx nf n] keeps a pool of [n] receive pages
+    per queue permanently granted to the backend of [nf]. Pooled pages are
+    posted on the RX ring in priority and recycled as soon as the
+    [listen] callback is done with them, so that they are not
+    re-granted for every packet. Pages are granted on demand, as
+    before, whenever the pool is exhausted. The pool is re-created
+    with the same size when the unikernel is resumed. *)
+
+val rx_grants : t -> int
+(** [rx_grants nf] is the number of grant table entries set up on
+    the receive path of [nf] since it was (re)connected. *)
+
 val add_resume_hook : t -> (t -> unit Lwt.t) -> unit
 (** [add_resume_hook nf cb] adds [cb] as a resume hook for netfront
 	  [nf] - called on resume before the service threads are
@@ -30,43 +30,117 @@ open Lwt
    +-----------------------------------------------------------------+ *)
 
 type sleep = {
-  time : float;
-  mutable canceled : bool;
+  tick : int;                   (* first wheel tick not before the wakeup time *)
   thread : unit Lwt.u;
+  mutable level : int;          (* level of the wheel holding it, or -1 *)
+  mutable at : int;             (* tick it is hashed by, at most [tick] *)
+  mutable node : sleep Lwt_sequence.node option;
 }
 
-module SleepQueue =
-  Lwt_pqueue.Make (struct
-                     type t = sleep
-                     let compare { time = t1 } { time = t2 } = compare t1 t2
-                   end)
-
-(* Threads waiting for a timeout to expire: *)
-let sleep_queue = ref SleepQueue.empty
-
-(* Sleepers added since the last iteration of the main loop:
-
-   They are not added immediatly to the main sleep queue in order to
-   prevent them from being wakeup immediatly by [restart_threads].
-*)
-let new_sleeps = ref []
+(* Sleepers are kept in a hashed hierarchical timer wheel of 1ms ticks
+   of {!Clock.elapsed_ns}, which wallclock changes do not disturb,
+   as in the Linux kernel. Level 0 has a slot per tick for the next 256
+   ticks, and each level above has 64 slots, each spanning a full turn
+   of the level below. A sleeper is hashed to a slot by its expiry tick
+   and, as the wheel turns, the slots of the upper levels are spread
+   ("cascaded") over the lower ones. Adding, cancelling and expiring a
+   sleeper are all O(1), and cancelled sleepers are removed at once. *)
+
+let ns_per_tick = 1_000_000
+
+(* [shift.(l)] is log2 of the number of ticks spanned by a slot of level [l] *)
+let shift = [| 0; 8; 14; 20; 26 |]
+let levels = Array.length shift
+
+let wheel =
+  Array.init levels (fun l ->
+    Array.init (if l = 0 then 256 else 64) (fun _ -> Lwt_sequence.create ()))
+
+(* Number of sleepers in each level *)
+let counts = Array.make levels 0
+
+(* Sleepers further away than a full turn of the top level are parked
+   as far as it reaches, and hashed again when their slot comes round *)
+let max_delta = 1 lsl 32 - 1
+
+let slot level tick =
+  (tick lsr shift.(level)) land (Array.length wheel.(level) - 1)
+
+let tick_of_ns ns = (ns + ns_per_tick - 1) / ns_per_tick
+
+(* Every tick before [current] has been expired *)
+let current = ref (Clock.elapsed_ns_int () / ns_per_tick)
+
+(* Sleepers which were already due when added, [yield]s among them *)
+let due = ref (Lwt_sequence.create ())
+
+(* Earliest tick a sleeper in the wheel is hashed by, [max_int] if there
+   are none, or -1 if it has to be computed again *)
+let next_tick = ref max_int
+
+let insert s =
+  let delta = s.tick - !current in
+  if delta < 0 then begin
+    s.level <- -1;
+    s.node <- Some (Lwt_sequence.add_r s !due)
+  end else begin
+    let tick = if delta > max_delta then !current + max_delta else s.tick in
+    let delta = tick - !current in
+    let rec level l =
+      if l = levels - 1 || delta < 1 lsl shift.(l + 1) then l else level (l + 1) in
+    let l = level 0 in
+    s.level <- l;
+    s.at <- tick;
+    counts.(l) <- counts.(l) + 1;
+    s.node <- Some (Lwt_sequence.add_r s wheel.(l).(slot l tick));
+    if !next_tick >= 0 && tick < !next_tick then next_tick := tick
+  end
+
+let remove s =
+  match s.node with
+    | None -> ()
+    | Some node ->
+        Lwt_sequence.remove node;
+        s.node <- None;
+        if s.level >= 0 then begin
+          counts.(s.level) <- counts.(s.level) - 1;
+          if s.at <= !next_tick then next_tick := -1
+        end
+
+(* Take the sleepers out of a slot of level [l], in insertion order *)
+let take_slot l seq =
+  let rec loop acc =
+    match Lwt_sequence.take_opt_r seq with
+      | None -> acc
+      | Some s ->
+          s.node <- None;
+          counts.(l) <- counts.(l) - 1;
+          loop (s :: acc) in
+  loop []
+
+(* Longer sleeps are cut to this many seconds (about 31 years), so that
+   their deadline fits in an int *)
+let max_sleep = 1e9
 
 let sleep d =
   let (res, w) = Lwt.task () in
-  let t = if d <= 0. then 0. else Clock.time () +. d in
-  let sleeper = { time = t; canceled = false; thread = w } in
-  new_sleeps := sleeper :: !new_sleeps;
-  Lwt.on_cancel res (fun _ -> sleeper.canceled <- true);
+  let tick =
+    if d <= 0. then 0
+    else tick_of_ns (Clock.elapsed_ns_int () + int_of_float (min d max_sleep *. 1e9)) in
+  let sleeper = { tick; thread = w; level = -1; at = 0; node = None } in
+  insert sleeper;
+  Lwt.on_cancel res (fun _ -> remove sleeper);
   res
 
 let yield () = sleep 0.
 
 let auto_yield timeout =
-  let limit = ref (Clock.time () +. timeout) in
+  let timeout = int_of_float (min timeout max_sleep *. 1e9) in
+  let limit = ref (Clock.elapsed_ns_int () + timeout) in
   fun () ->
-    let current = Clock.time () in
+    let current = Clock.elapsed_ns_int () in
     if current >= !limit then begin
-      limit := current +. timeout;
+      limit := current + timeout;
       yield ();
     end else
       return ()
@@ -77,20 +151,54 @@ let timeout d = sleep d >> Lwt.fail Timeout
 
 let with_timeout d f = Lwt.pick [timeout d; Lwt.apply f ()]
 
-let in_the_past now t =
-  t = 0. || t <= now ()
-
-let rec restart_threads now =
-  match SleepQueue.lookup_min !sleep_queue with
-    | Some{ canceled = true } ->
-        sleep_queue := SleepQueue.remove_min !sleep_queue;
-        restart_threads now
-    | Some{ time = time; thread = thread } when in_the_past now time ->
-        sleep_queue := SleepQueue.remove_min !sleep_queue;
-        Lwt.wakeup thread ();
-        restart_threads now
-    | _ ->
-        ()
+(* Wake up the sleepers of a slot of level [l] ([-1] for [due]) one at
+   a time, so that those cancelled by an earlier one are skipped *)
+let rec wakeup_slot l seq =
+  match Lwt_sequence.take_opt_l seq with
+    | None -> ()
+    | Some s ->
+        s.node <- None;
+        if l >= 0 then counts.(l) <- counts.(l) - 1;
+        Lwt.wakeup s.thread ();
+        wakeup_slot l seq
+
+(* Expire every tick up to [now_tick]. Stretches with nothing to cascade
+   or expire are skipped, so that a long sleep of the domain costs no
+   more than a short one. *)
+let expire now_tick =
+  while !current <= now_tick do
+    let c = !current in
+    (* At the start of a turn of each level, spread the next slot of the
+       level above over it *)
+    let rec cascade l =
+      if l < levels then begin
+        let i = slot l c in
+        List.iter insert (take_slot l wheel.(l).(i));
+        if i = 0 then cascade (l + 1)
+      end in
+    if slot 0 c = 0 then cascade 1;
+    wakeup_slot 0 wheel.(0).(slot 0 c);
+    current := c + 1;
+    if counts.(0) = 0 then begin
+      let rec lowest l = if l = levels || counts.(l) > 0 then l else lowest (l + 1) in
+      let l = lowest 1 in
+      let next =
+        if l = levels then now_tick + 1
+        else let span = 1 lsl shift.(l) in (c + span) land (lnot (span - 1)) in
+      current := max !current (min next (now_tick + 1))
+    end
+  done;
+  next_tick := -1
+
+let restart_threads now =
+  (* Sleepers added while these are woken up wait for the next call *)
+  let batch = !due in
+  if not (Lwt_sequence.is_empty batch) then begin
+    due := Lwt_sequence.create ();
+    wakeup_slot (-1) batch
+  end;
+  let now_tick = now () / ns_per_tick in
+  if !current <= now_tick then expire now_tick
 
 (* +-----------------------------------------------------------------+
    | Event loop                                                      |
@@ -101,22 +209,42 @@ let min_timeout a b = match a, b with
   | a, None -> a
   | Some a, Some b -> Some(min a b)
 
-let rec get_next_timeout now =
-  match SleepQueue.lookup_min !sleep_queue with
-    | Some{ canceled = true } ->
-        sleep_queue := SleepQueue.remove_min !sleep_queue;
-        get_next_timeout now 
-    | Some{ time = time } ->
-        Some (if time = 0. then 0. else max 0. (time -. (now ())))
-    | None ->
-        None
-
-let select_next now =
-  (* Transfer all sleepers added since the last iteration to the main
-     sleep queue: *)
-  sleep_queue :=
-    List.fold_left
-      (fun q e -> SleepQueue.add e q) !sleep_queue !new_sleeps;
-  new_sleeps := [];
-  get_next_timeout now 
-
+(* The first non-empty slot of level 0 from the current tick holds the
+   earliest sleepers of that level. In the upper levels they are in the
+   first non-empty slot after the current one, or in the current one if
+   it is yet to be cascaded. Parked sleepers count at the tick they are
+   hashed by, which makes the domain wake up in time to move them. *)
+let compute_next_tick () =
+  let best = ref max_int in
+  let c = !current in
+  if counts.(0) > 0 then begin
+    let i = ref 0 in
+    while !best = max_int && !i < 256 do
+      if not (Lwt_sequence.is_empty wheel.(0).((c + !i) land 255)) then
+        best := c + !i;
+      incr i
+    done
+  end;
+  for l = 1 to levels - 1 do
+    if counts.(l) > 0 then begin
+      let slots = wheel.(l) and n = Array.length wheel.(l) in
+      let first = if c land (1 lsl shift.(l) - 1) = 0 then 0 else 1 in
+      let i = ref first and found = ref false in
+      while not !found && !i < first + n do
+        let seq = slots.((slot l c + !i) land (n - 1)) in
+        if not (Lwt_sequence.is_empty seq) then begin
+          found := true;
+          best := Lwt_sequence.fold_l (fun s m -> min s.at m) seq !best
+        end;
+        incr i
+      done
+    end
+  done;
+  !best
+
+let next_deadline () =
+  if not (Lwt_sequence.is_empty !due) then Some 0
+  else begin
+    if !next_tick < 0 then next_tick := compute_next_tick ();
+    if !next_tick = max_int then None else Some (!next_tick * ns_per_tick)
+  end
@@ -16,18 +16,21 @@
 
 (** Timeout operations. *)
 
-val restart_threads: (unit -> float) -> unit
-(** [restart_threads time_fun] restarts threads that are sleeping and
-    whose wakeup time is before [time_fun ()]. *)
-
-val select_next : (unit -> float) -> float option
-(** [select_next time_fun] is [Some t] where [t] is the earliest time
-    when one sleeping thread will wake up, or [None] if there is no
-    sleeping threads. *)
+val restart_threads: (unit -> int) -> unit
+(** [restart_threads now] restarts threads that are sleeping and whose
+    wakeup time is before [now ()], in nanoseconds of
+    {!Clock.elapsed_ns}. *)
+
+val next_deadline : unit -> int option
+(** [next_deadline ()] is [Some t] where [t] is the time, in
+    nanoseconds of {!Clock.elapsed_ns}, at which [restart_threads] will
+    next have a thread to wake up (or [0] if one is due already), or
+    [None] if there are no sleeping threads. This is what the domain
+    blocks until when there is nothing else to do. *)
 
 val sleep : float -> unit Lwt.t
 (** [sleep d] is a threads which remain suspended for [d] seconds and
-    then terminates. *)
+    then terminates. Setting the wallclock does not affect it. *)
 
 exception Timeout
 (** Exception raised by timeout operations *)
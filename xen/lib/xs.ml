@@ -103,7 +103,71 @@ let make () =
         return c
     )
 
+let read_many h paths =
+  (* The client matches replies to requests by id, so reads issued by
+     parallel threads are all on the ring before the first reply *)
+  Lwt_list.map_p (read h) paths
+
+(* Read-mostly keys are remembered until their watch fires. Each entry
+   has a [wait] thread, which watches the paths read through its handle
+   and reruns its function whenever one of them changes. *)
+type entry = {
+  value: string option Lwt.t;
+  watcher: unit Lwt.t;
+}
+
+let cache = Hashtbl.create 16
+
+let read_opt h path =
+  try_lwt
+    read h path >|= fun v -> Some v
+  with Xs_protocol.Enoent _ ->
+    return None
+
+let cached_read client path =
+  let value =
+    try (Hashtbl.find cache path).value
+    with Not_found ->
+      let value, u = Lwt.wait () in
+      let seen = ref None in
+      let watcher =
+        try_lwt
+          wait client (fun h ->
+            lwt v = read_opt h path in
+            match !seen with
+            | None ->
+              (* Xenstore fires every watch once when it is set, so the
+                 first rerun usually finds the same value *)
+              seen := Some v;
+              Lwt.wakeup u v;
+              fail Xs_protocol.Eagain
+            | Some v' when v' = v -> fail Xs_protocol.Eagain
+            | Some _ -> return ())
+        with exn ->
+          if Lwt.state value = Sleep then Lwt.wakeup_exn u exn;
+          return () in
+      let forget () =
+        match (try Some (Hashtbl.find cache path) with Not_found -> None) with
+        | Some e when e.value == value -> Hashtbl.remove cache path
+        | _ -> () in
+      (* Only cache while the watch is in place *)
+      if Lwt.state watcher = Sleep then begin
+        Hashtbl.replace cache path { value; watcher };
+        Lwt.on_termination watcher forget
+      end;
+      value in
+  value >>= function
+  | Some v -> return v
+  | None -> fail (Xs_protocol.Enoent path)
+
+let flush_cache () =
+  let entries = Hashtbl.fold (fun _ e acc -> e :: acc) cache [] in
+  Hashtbl.clear cache;
+  List.iter (fun e -> Lwt.cancel e.watcher) entries
+
 let resume client =
+	(* Watches do not survive a suspend, so neither can the cache *)
+	flush_cache ();
 	lwt ch = open_channel () in
 	begin match !t with
 		| Some ch' ->
@@ -51,6 +51,21 @@ val rm : handle -> string -> unit Lwt.t
 
 val mkdir: handle -> string -> unit Lwt.t
 
+val read_many : handle -> string list -> string list Lwt.t
+(** [read_many h paths] reads every one of [paths], issuing all the
+    requests before waiting for the first reply, and fails like [read]
+    if any of them does. *)
+
+val cached_read : client -> string -> string Lwt.t
+(** [cached_read c path] is the value at [path], read once and then
+    served from memory until a watch reports that [path] changed. Use it
+    for read-mostly keys such as backend paths and features. Like
+    [read], it raises [Enoent] if [path] does not exist. *)
+
+val flush_cache : unit -> unit
+(** [flush_cache ()] forgets every value remembered by [cached_read]
+    and removes their watches. {!resume} calls it. *)
+
 val suspend : client -> unit Lwt.t
 (** [suspend ()] suspends the xenstore client, waiting for outstanding
     RPCs to be completed, cancelling all watches and causing new
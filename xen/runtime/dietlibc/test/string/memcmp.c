@@ -1,10 +1,30 @@
 #include <string.h>
 #include <assert.h>
 
+static int sign(int x) { return (x>0)-(x<0); }
+
 int main() {
   const char* test="blubber";
+  unsigned char a[600], b[600];
+  size_t i,len,k;
+
   assert(memcmp(test,"blubber",8)==0);
   assert(memcmp(test,"fnord",5)<0);
   assert(memcmp(test,0,0)==0);
+
+  /* a single differing byte at every position, at every alignment of
+   * the second operand; the sign must follow the unsigned byte order */
+  for (i=0; i<16; ++i)
+    for (len=1; len<520; len+=(len<80 ? 1 : 37)) {
+      for (k=0; k<len; ++k)
+	a[k]=b[i+k]=(unsigned char)(k*13);
+      assert(memcmp(a,b+i,len)==0);
+      for (k=0; k<len; ++k) {
+	b[i+k]^=0x80;
+	assert(sign(memcmp(a,b+i,len))==(a[k]<b[i+k] ? -1 : 1));
+	assert(sign(memcmp(b+i,a,len))==(a[k]<b[i+k] ? 1 : -1));
+	b[i+k]^=0x80;
+      }
+    }
   return 0;
 }
@@ -0,0 +1,35 @@
+#include <string.h>
+#include <assert.h>
+
+static unsigned char buf[4400], ref[4400];
+
+static void check(size_t dst, size_t src, size_t len) {
+  size_t k;
+  for (k=0; k<sizeof(buf); ++k)
+    buf[k] = ref[k] = (unsigned char)(k*7+k/251);
+  assert(memmove(buf+dst,buf+src,len)==buf+dst);
+  if (dst<src)
+    for (k=0; k<len; ++k) ref[dst+k]=ref[src+k];
+  else
+    for (k=len; k>0; --k) ref[dst+k-1]=ref[src+k-1];
+  assert(!memcmp(buf,ref,sizeof(buf)));
+}
+
+int main() {
+  size_t const LENS[] = { 0, 1, 3, 8, 15, 16, 17, 32, 33, 64, 65, 100, 255,
+			  256, 257, 1500, 2047, 2048, 2049, 4096 };
+  size_t i,d;
+
+  assert(memmove(0,0,0)==0);
+
+  /* overlapping in both directions at every distance up to 40 bytes */
+  for (i=0; i<sizeof(LENS)/sizeof(LENS[0]); ++i)
+    for (d=0; d<=40; ++d) {
+      check(100+d,100,LENS[i]);
+      check(100,100+d,LENS[i]);
+      check(101+d,103,LENS[i]);
+      check(103,101+d,LENS[i]);
+    }
+
+  return 0;
+}
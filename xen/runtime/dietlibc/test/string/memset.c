@@ -0,0 +1,26 @@
+#include <string.h>
+#include <assert.h>
+
+int main() {
+  unsigned char buf[4200];
+  size_t i,j,k;
+
+  assert(memset(buf,0,0)==buf);
+  assert(memset(0,0,0)==0);
+
+  /* every alignment, lengths around each size-class boundary and the
+   * "rep stosb" threshold; the guard bytes around the range must stay */
+  for (i=0; i<16; ++i)
+    for (j=0; j<4096+80; j+=(j<160 ? 1 : 61)) {
+      memset(buf,0x5a,sizeof(buf));
+      assert(memset(buf+i+8,0xa5+(int)j,j)==buf+i+8);
+      for (k=0; k<i+8; ++k)
+	assert(buf[k]==0x5a);
+      for (k=0; k<j; ++k)
+	assert(buf[i+8+k]==(unsigned char)(0xa5+j));
+      for (k=i+8+j; k<sizeof(buf); ++k)
+	assert(buf[k]==0x5a);
+    }
+
+  return 0;
+}
@@ -31,6 +31,12 @@ void init_events(void);
 int evtchn_alloc_unbound(domid_t pal, evtchn_port_t *port);
 int evtchn_bind_interdomain(domid_t pal, evtchn_port_t remote_port, evtchn_port_t *local_port);
 void unbind_all_ports(void);
+int evtchn_bind_virq(uint32_t virq, evtchn_port_t *port);
+
+/* The runtime's dispatch of the ports which fired, eventchn_stubs.c */
+void evtchn_poll(void);
+unsigned int evtchn_bound_ports(evtchn_port_t **ports);
+void evtchn_bound_ports_reset(void);
 
 static inline int notify_remote_via_evtchn(evtchn_port_t port)
 {
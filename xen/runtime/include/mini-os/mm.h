@@ -42,6 +42,12 @@ unsigned long alloc_pages(int order);
 void free_pages(void *pointer, int order);
 #define free_page(p)    free_pages(p, 0)
 
+/* Page allocator statistics */
+unsigned long free_chunks(int order);
+unsigned long total_free_pages(void);
+int largest_free_order(void);
+unsigned int fragmentation_index(int order);
+
 static __inline__ int get_order(unsigned long size)
 {
     int order;
@@ -56,4 +56,10 @@ s_time_t get_v_time(void);
 uint64_t monotonic_clock(void);
 void     block_domain(s_time_t until);
 
+/* Time elapsed since boot, not counting suspensions, clock_stubs.c */
+void     clock_suspend(void);
+void     clock_resume(void);
+s_time_t clock_elapsed(void);
+s_time_t clock_elapsed_to_system(s_time_t t);
+
 #endif /* _MINIOS_TIME_H_ */
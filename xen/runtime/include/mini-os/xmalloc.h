@@ -22,4 +22,15 @@ static inline void *_xmalloc_array(size_t size, size_t align, size_t num)
 /* Allocate space for array of typed objects. */
 #define xmalloc_array(_type, _num) ((_type *)_xmalloc_array(sizeof(_type), __alignof__(_type), _num))
 
+struct xmalloc_stats {
+    unsigned long mallocs;      /* successful allocations */
+    unsigned long frees;
+    unsigned long small_bytes;  /* in use by small objects, by size class */
+    unsigned long slab_pages;   /* pages held by small object slabs */
+    unsigned long large_bytes;  /* requested by large allocations */
+    unsigned long large_pages;  /* pages held by large allocations */
+};
+
+void xmalloc_get_stats(struct xmalloc_stats *stats);
+
 #endif /* __XMALLOC_H__ */
@@ -20,6 +20,7 @@
 #include <caml/memory.h>
 #include <caml/fail.h>
 #include <caml/bigarray.h>
+#include <immintrin.h>
 
 /* WARNING: This code assumes that it is running on a little endian machine (x86) */
 static inline uint16_t
@@ -34,31 +35,271 @@ ntohs(uint16_t v)
   return (htons(v));
 }
 
-static uint16_t
-ones_complement_checksum_bigarray(unsigned char *addr, size_t ofs, size_t count, uint64_t sum64)
+static inline uint64_t
+add_carry(uint64_t sum64, uint64_t v)
 {
-  addr += ofs;
-  uint64_t *data64 = (uint64_t *) addr;
+  sum64 += v;
+  if (sum64 < v) sum64++;
+  return sum64;
+}
+
+/* The vector kernels below sum 32-bit words into 64-bit lanes, which
+   cannot overflow, and fold them into the end-around-carry sum at the
+   end. All sums are congruent modulo 0xffff, so the folded result is
+   bit-identical to the scalar loop. Each consumes a multiple of its
+   block size and leaves the tail to the caller. */
+
+static uint64_t
+sum_block_scalar(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  const uint64_t *data64 = (const uint64_t *) addr;
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    sum64 = add_carry(sum64, data64[0]);
+    sum64 = add_carry(sum64, data64[1]);
+    sum64 = add_carry(sum64, data64[2]);
+    sum64 = add_carry(sum64, data64[3]);
+    data64 += 4;
+  }
+  return sum64;
+}
+
+static __attribute__((target("sse2"))) uint64_t
+sum_block_sse2(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  uint64_t lanes[2];
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *) addr);
+    __m128i v1 = _mm_loadu_si128((const __m128i *) (addr + 16));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+    addr += 32;
+  }
+  _mm_storeu_si128((__m128i *) lanes, acc0);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  _mm_storeu_si128((__m128i *) lanes, acc1);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  return sum64;
+}
+
+static __attribute__((target("avx2"))) uint64_t
+sum_block_avx2(const unsigned char *addr, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  uint64_t lanes[4];
+  size_t n = count / 64;
+  int i;
+  *done = n * 64;
+  while (n-- > 0) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *) addr);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *) (addr + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    addr += 64;
+  }
+  _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+  for (i = 0; i < 4; i++)
+    sum64 = add_carry(sum64, lanes[i]);
+  return sum64;
+}
+
+/* Same as the above, also copying the bytes summed to dst */
+
+static uint64_t
+copy_sum_block_scalar(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  const uint64_t *src64 = (const uint64_t *) src;
+  uint64_t *dst64 = (uint64_t *) dst;
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    uint64_t a = src64[0], b = src64[1], c = src64[2], d = src64[3];
+    dst64[0] = a; dst64[1] = b; dst64[2] = c; dst64[3] = d;
+    sum64 = add_carry(sum64, a);
+    sum64 = add_carry(sum64, b);
+    sum64 = add_carry(sum64, c);
+    sum64 = add_carry(sum64, d);
+    src64 += 4;
+    dst64 += 4;
+  }
+  return sum64;
+}
+
+static __attribute__((target("sse2"))) uint64_t
+copy_sum_block_sse2(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  uint64_t lanes[2];
+  size_t n = count / 32;
+  *done = n * 32;
+  while (n-- > 0) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *) src);
+    __m128i v1 = _mm_loadu_si128((const __m128i *) (src + 16));
+    _mm_storeu_si128((__m128i *) dst, v0);
+    _mm_storeu_si128((__m128i *) (dst + 16), v1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+    src += 32;
+    dst += 32;
+  }
+  _mm_storeu_si128((__m128i *) lanes, acc0);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  _mm_storeu_si128((__m128i *) lanes, acc1);
+  sum64 = add_carry(sum64, lanes[0]);
+  sum64 = add_carry(sum64, lanes[1]);
+  return sum64;
+}
+
+static __attribute__((target("avx2"))) uint64_t
+copy_sum_block_avx2(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64, size_t *done)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  uint64_t lanes[4];
+  size_t n = count / 64;
+  int i;
+  *done = n * 64;
+  while (n-- > 0) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *) src);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *) (src + 32));
+    _mm256_storeu_si256((__m256i *) dst, v0);
+    _mm256_storeu_si256((__m256i *) (dst + 32), v1);
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    src += 64;
+    dst += 64;
+  }
+  _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+  for (i = 0; i < 4; i++)
+    sum64 = add_carry(sum64, lanes[i]);
+  return sum64;
+}
+
+typedef uint64_t (*sum_block_fn)(const unsigned char *, size_t, uint64_t, size_t *);
+typedef uint64_t (*copy_sum_block_fn)(unsigned char *, const unsigned char *, size_t, uint64_t, size_t *);
+
+static sum_block_fn sum_block = NULL;
+static copy_sum_block_fn copy_sum_block = NULL;
+
+static void
+select_kernels(void)
+{
+  uint32_t eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+  __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+  if (eax >= 7) {
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    /* The OS must have enabled the YMM state (OSXSAVE and XCR0) */
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+      __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+      if ((xcr0_lo & 6) == 6) {
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+        if (ebx & (1 << 5)) {
+          copy_sum_block = copy_sum_block_avx2;
+          sum_block = sum_block_avx2;
+          return;
+        }
+      }
+    }
+  }
+  /* SSE2 is part of x86_64 */
+  copy_sum_block = copy_sum_block_sse2;
+  sum_block = sum_block_sse2;
+}
+
+/* Add the 16-bit words of [addr, addr + count) to sum64, count even */
+static uint64_t
+sum_words(const unsigned char *addr, size_t count, uint64_t sum64)
+{
+  size_t done = 0;
+
+  if (sum_block == NULL)
+    select_kernels();
+  /* Short buffers are not worth the vector setup */
+  if (count >= 128)
+    sum64 = sum_block(addr, count, sum64, &done);
+  else
+    sum64 = sum_block_scalar(addr, count, sum64, &done);
+  addr += done;
+  count -= done;
+
   while (count >= 8) {
-    uint64_t s = *data64++;
-    sum64 += s;
-    if (sum64 < s) sum64++;
+    sum64 = add_carry(sum64, *(const uint64_t *) addr);
     count -= 8;
+    addr += 8;
   }
-
-  addr = (unsigned char *) data64;
   while (count > 1) {
-    uint16_t v = *((uint16_t *) addr);
-    sum64 += v;
-    if (sum64 < v) sum64++;
+    sum64 = add_carry(sum64, *(const uint16_t *) addr);
     count -= 2;
     addr += 2;
   }
+  return sum64;
+}
+
+/* Copy [src, src + count) to dst, adding its 16-bit words to sum64,
+   count even */
+static uint64_t
+copy_sum_words(unsigned char *dst, const unsigned char *src, size_t count, uint64_t sum64)
+{
+  size_t done = 0;
+
+  if (copy_sum_block == NULL)
+    select_kernels();
+  if (count >= 128)
+    sum64 = copy_sum_block(dst, src, count, sum64, &done);
+  else
+    sum64 = copy_sum_block_scalar(dst, src, count, sum64, &done);
+  dst += done;
+  src += done;
+  count -= done;
+
+  while (count >= 8) {
+    uint64_t v = *(const uint64_t *) src;
+    *(uint64_t *) dst = v;
+    sum64 = add_carry(sum64, v);
+    count -= 8;
+    src += 8;
+    dst += 8;
+  }
+  while (count > 1) {
+    uint16_t v = *(const uint16_t *) src;
+    *(uint16_t *) dst = v;
+    sum64 = add_carry(sum64, v);
+    count -= 2;
+    src += 2;
+    dst += 2;
+  }
+  return sum64;
+}
 
-  if (count > 0) {
+static uint16_t
+ones_complement_checksum_bigarray(unsigned char *addr, size_t ofs, size_t count, uint64_t sum64)
+{
+  addr += ofs;
+  sum64 = sum_words(addr, count & ~(size_t)1, sum64);
+  addr += count & ~(size_t)1;
+
+  if (count & 1) {
     uint16_t v = ntohs((*addr) << 8);
-    sum64 += v;
-    if (sum64 < v) sum64++;
+    sum64 = add_carry(sum64, v);
   }
 
   while (sum64 >> 16)
@@ -95,9 +336,7 @@ caml_ones_complement_checksum_list(value v_cstruct_list)
   size_t count = 0;
   struct caml_ba_array *a = NULL;
   unsigned char *addr;
-  uint64_t *data64;
   uint64_t sum64 = 0;
-  const size_t sizeof_ll = 8; /* sizeof (uint64_t) */
   while (v_cstruct_list != Val_emptylist) {
     v_hd = Field(v_cstruct_list, 0);
     v_cstruct_list = Field(v_cstruct_list, 1);
@@ -117,129 +356,129 @@ caml_ones_complement_checksum_list(value v_cstruct_list)
       count--;
     }
 
-    data64 = (uint64_t *) addr;
-
-#define checksum_DO_PARTIAL_LOOP_UNROLL
-#ifdef checksum_DO_PARTIAL_LOOP_UNROLL
-    while (count >= (20 * sizeof_ll)) {
-      uint64_t s;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+    sum64 = sum_words(addr, count & ~(size_t)1, sum64);
+    addr += count & ~(size_t)1;
 
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+    if (count & 1) {
+      overflow_val = *addr;
+      overflow = 1;
+    }
 
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+  }
 
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+  if (overflow != 0) {
+    overflow_val = ntohs(overflow_val << 8);
+    sum64 += overflow_val;
+    if (sum64 < overflow_val) sum64++;
+  }
 
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+  while (sum64 >> 16)
+    sum64 = (sum64 & 0xffff) + (sum64 >> 16);
+  checksum = htons(~sum64);
+  CAMLreturn(Val_int(checksum));
+}
 
-      s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
+/* Copy a list of cstruct.ts back to back into the cstruct v_dst, and
+ * return the ones complement sum of the bytes copied. The sum is folded
+ * to 16 bits but not complemented, so that the caller can still add in
+ * a pseudo-header before taking the complement. Reading and summing
+ * each byte as it is copied saves a second pass over the payload.
+ * Raises Invalid_argument, before copying anything, if v_dst is too
+ * short. */
+CAMLprim value
+caml_ones_complement_checksum_copy(value v_dst, value v_src_list)
+{
+  CAMLparam2(v_dst, v_src_list);
+  CAMLlocal2(v_list, v_hd);
+  uint16_t overflow_val = 0;
+  uint16_t overflow = 0;
+  size_t count, total = 0;
+  unsigned char *dst, *src;
+  uint64_t sum64 = 0;
 
-      count -= (20 * sizeof_ll);
-    }
-#endif
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1))
+    total += Int_val(Field(Field(v_list, 0), 2));
+  if (total > (size_t) Int_val(Field(v_dst, 2)))
+    caml_invalid_argument("caml_ones_complement_checksum_copy");
 
-    while (count >= sizeof_ll)	{
-      uint64_t s = *data64++;
-      sum64 += s;
-      if (sum64 < s) sum64++;
-      count -= sizeof_ll;
+  dst = (unsigned char *) Caml_ba_data_val(Field(v_dst, 0)) + Int_val(Field(v_dst, 1));
+  for (v_list = v_src_list; v_list != Val_emptylist; v_list = Field(v_list, 1)) {
+    v_hd = Field(v_list, 0);
+    src = (unsigned char *) Caml_ba_data_val(Field(v_hd, 0)) + Int_val(Field(v_hd, 1));
+    count = Int_val(Field(v_hd, 2));
+    if (count <= 0) continue;
+    if (overflow != 0) {
+      *dst++ = *src;
+      overflow_val = ntohs((overflow_val << 8) + (*src++));
+      sum64 = add_carry(sum64, overflow_val);
+      overflow = 0;
+      count--;
     }
 
-    addr = (unsigned char *) data64;
-    while (count > 1) {
-      uint16_t v = *((uint16_t *) addr);
-      sum64 += v;
-      if (sum64 < v) sum64++;
-      count -= 2;
-      addr += 2;
-    }
+    sum64 = copy_sum_words(dst, src, count & ~(size_t)1, sum64);
+    dst += count & ~(size_t)1;
+    src += count & ~(size_t)1;
 
-    if (count > 0) {
-      overflow_val = *addr;
+    if (count & 1) {
+      overflow_val = *dst++ = *src;
       overflow = 1;
     }
-
   }
 
   if (overflow != 0) {
     overflow_val = ntohs(overflow_val << 8);
-    sum64 += overflow_val;
-    if (sum64 < overflow_val) sum64++;
+    sum64 = add_carry(sum64, overflow_val);
   }
 
   while (sum64 >> 16)
     sum64 = (sum64 & 0xffff) + (sum64 >> 16);
-  checksum = htons(~sum64);
-  CAMLreturn(Val_int(checksum));
+  CAMLreturn(Val_int(htons(sum64)));
+}
+
+/* Incremental updates, after RFC 1624. Checksums and field values are
+ * passed as read from the packet with Cstruct.BE; the arithmetic does
+ * not depend on byte order as long as it is the same throughout. */
+
+static inline uint16_t
+fold32(uint32_t sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+/* The checksum [csum] after a 16-bit field changed from [old] to [new]:
+ * HC' = ~(~HC + ~m + m'), eqn. 3 of RFC 1624 */
+CAMLprim value
+caml_ones_complement_checksum_update16(value v_csum, value v_old, value v_new)
+{
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~Int_val(v_old);
+  sum += (uint16_t) Int_val(v_new);
+  return Val_int((uint16_t) ~fold32(sum));
 }
 
+/* The same for a 32-bit field, such as an IPv4 address, given as
+ * Int32.ts */
+CAMLprim value
+caml_ones_complement_checksum_update32(value v_csum, value v_old, value v_new)
+{
+  uint32_t old = Int32_val(v_old), new = Int32_val(v_new);
+  uint32_t sum = (uint16_t) ~Int_val(v_csum);
+  sum += (uint16_t) ~(old >> 16) + (uint16_t) ~(old & 0xffff);
+  sum += (new >> 16) + (new & 0xffff);
+  return Val_int((uint16_t) ~fold32(sum));
+}
+
+/* Checksum a list of buffers together with [v_partial], the (folded,
+ * uncomplemented) sum of other data already known, e.g. an unchanged
+ * payload or a pseudo-header. That data must span an even number of
+ * bytes. */
+CAMLprim value
+caml_ones_complement_checksum_list_with(value v_partial, value v_list)
+{
+  uint16_t csum = Int_val(caml_ones_complement_checksum_list(v_list));
+  uint32_t sum = (uint16_t) ~csum;
+  sum += (uint16_t) Int_val(v_partial);
+  return Val_int((uint16_t) ~fold32(sum));
+}
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <mini-os/x86/os.h>
+#include <mini-os/time.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -32,6 +34,52 @@ unix_gettimeofday(value v_unit)
   CAMLreturn(caml_copy_double((double) tp.tv_sec + (double) tp.tv_usec / 1e6));
 }
 
+/* Elapsed time is NOW() plus this offset. NOW() counts from the host's
+   boot, so it can jump either way when the domain is resumed, possibly
+   on another host; the offset is set so that elapsed time instead
+   carries on from where it was when the domain was suspended. */
+static s_time_t elapsed_offset;
+static s_time_t elapsed_at_suspend;
+
+void
+clock_suspend(void)
+{
+  elapsed_at_suspend = NOW() + elapsed_offset;
+}
+
+void
+clock_resume(void)
+{
+  elapsed_offset = elapsed_at_suspend - NOW();
+}
+
+s_time_t
+clock_elapsed(void)
+{
+  return NOW() + elapsed_offset;
+}
+
+/* Convert an elapsed time to the system time the hypervisor expects */
+s_time_t
+clock_elapsed_to_system(s_time_t t)
+{
+  return t - elapsed_offset;
+}
+
+CAMLprim value
+caml_clock_elapsed_ns(value v_unit)
+{
+  return caml_copy_int64(clock_elapsed());
+}
+
+/* Same, as a tagged int (63 bits hold over a century of nanoseconds);
+   does not allocate */
+CAMLprim value
+caml_clock_elapsed_ns_int(value v_unit)
+{
+  return Val_long(clock_elapsed());
+}
+
 static value alloc_tm(struct tm *tm)
 {
   value res;
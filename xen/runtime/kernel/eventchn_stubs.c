@@ -23,15 +23,62 @@
 #include <caml/callback.h>
 #include <caml/bigarray.h>
 
-#define NR_EVENTS 8
-static uint8_t ev_callback_ml[NR_EVENTS];
+#define LONG_BITS (sizeof(unsigned long) * 8)
+
+/* Ports which fired since the OCaml side last looked at them, as a
+   2-level bitmap like the one in the shared info page: bit i of
+   ev_pending_sel is set if any bit of ev_pending[i] is. */
+static unsigned long ev_pending_sel;
+static unsigned long ev_pending[NR_EVENT_CHANNELS / LONG_BITS];
+
+/* Ports bound through the stubs below, plus the console and xenstore
+   ones, which caml_block_domain polls on */
+static evtchn_port_t bound_ports[NR_EVENT_CHANNELS];
+static unsigned int nr_bound_ports;
+
+static void
+bound_ports_add(evtchn_port_t port)
+{
+  unsigned int i;
+  for (i = 0; i < nr_bound_ports; i++)
+    if (bound_ports[i] == port)
+      return;
+  bound_ports[nr_bound_ports++] = port;
+}
+
+static void
+bound_ports_remove(evtchn_port_t port)
+{
+  unsigned int i;
+  for (i = 0; i < nr_bound_ports; i++)
+    if (bound_ports[i] == port) {
+      bound_ports[i] = bound_ports[--nr_bound_ports];
+      return;
+    }
+}
+
+/* Forget all bindings, which do not survive a resume */
+void
+evtchn_bound_ports_reset(void)
+{
+  nr_bound_ports = 0;
+  bound_ports_add(start_info.console.domU.evtchn);
+  bound_ports_add(start_info.store_evtchn);
+}
+
+unsigned int
+evtchn_bound_ports(evtchn_port_t **ports)
+{
+  *ports = bound_ports;
+  return nr_bound_ports;
+}
 
 #define active_evtchns(cpu,sh,idx)              \
     ((sh)->evtchn_pending[idx] &                \
      ~(sh)->evtchn_mask[idx])
 
-/* Walk through the ports, setting the OCaml callback
-   mask for any active ones, and clear the Xen side */
+/* Walk through the ports, setting the OCaml pending bit
+   for any active ones, and clear the Xen side */
 void
 evtchn_poll(void)
 {
@@ -52,37 +99,53 @@ evtchn_poll(void)
       l2i = __ffs(l2);
       l2 &= ~(1UL << l2i);
 
-      port = (l1i * (sizeof(unsigned long) * 8)) + l2i;
+      port = (l1i * LONG_BITS) + l2i;
       clear_evtchn(port);
-      ev_callback_ml[port] = 1;
+      ev_pending[l1i] |= 1UL << l2i;
+      ev_pending_sel |= 1UL << l1i;
     }
   }
 }
 
+/* Rescan from OCaml, so that a batch of scheduler rounds sees the
+   ports which fired since the callback began */
+CAMLprim value
+caml_evtchn_poll(value v_unit)
+{
+  evtchn_poll();
+  return Val_unit;
+}
+
 /* Initialise and bind the predefined ports */
 CAMLprim value
 caml_evtchn_init(value v_unit)
 {
     CAMLparam1(v_unit);
     CAMLlocal1(v_arr);
+    evtchn_bound_ports_reset();
     CAMLreturn(Val_unit);
 }
 
 CAMLprim value
 caml_nr_events(value v_unit)
 {
-   return Val_int(NR_EVENTS);
+   return Val_int(NR_EVENT_CHANNELS);
 }
 
+/* Clear and return the lowest port which fired, or -1 if none did */
 CAMLprim value
-caml_evtchn_test_and_clear(value v_idx)
+caml_evtchn_next_pending(value v_unit)
 {
-   int idx = Int_val(v_idx) % NR_EVENTS;
-   if (ev_callback_ml[idx] > 0) {
-      ev_callback_ml[idx] = 0;
-      return Val_int(1);
-   } else
-      return Val_int(0);
+   unsigned long l1i, l2i;
+
+   if (ev_pending_sel == 0)
+      return Val_int(-1);
+   l1i = __ffs(ev_pending_sel);
+   l2i = __ffs(ev_pending[l1i]);
+   ev_pending[l1i] &= ~(1UL << l2i);
+   if (ev_pending[l1i] == 0)
+      ev_pending_sel &= ~(1UL << l1i);
+   return Val_int(l1i * LONG_BITS + l2i);
 }
 
 CAMLprim value
@@ -96,12 +159,12 @@ stub_evtchn_alloc_unbound(value v_domid)
     rc = evtchn_alloc_unbound(domid, &port);
     if (rc)
        CAMLreturn(Val_int(-1));
-    else
-       CAMLreturn(Val_int(port)); 
+    bound_ports_add(port);
+    CAMLreturn(Val_int(port));
 }
 
 CAMLprim value
-stub_evtchn_bind_interdomain(value v_domid, evtchn_port_t v_remote_port)
+stub_evtchn_bind_interdomain(value v_domid, value v_remote_port)
 {
     CAMLparam2(v_domid, v_remote_port);
     domid_t domid = Int_val(v_domid);
@@ -112,8 +175,8 @@ stub_evtchn_bind_interdomain(value v_domid, evtchn_port_t v_remote_port)
     rc = evtchn_bind_interdomain(domid, remote_port, &local_port);
     if (rc)
        CAMLreturn(Val_int(-1));
-    else
-       CAMLreturn(Val_int(local_port)); 
+    bound_ports_add(local_port);
+    CAMLreturn(Val_int(local_port));
 }
 
 CAMLprim value
@@ -141,8 +204,8 @@ stub_bind_virq(value virq)
 	rc = evtchn_bind_virq(Int_val(virq), &port);
 	if (rc)
 		CAMLreturn(Val_int(-1));
-	else
-    	CAMLreturn(Val_int(port)); 
+	bound_ports_add(port);
+	CAMLreturn(Val_int(port));
 
 }
 
@@ -158,5 +221,6 @@ stub_evtchn_unbind(value v_port)
 {
 	CAMLparam1(v_port);
 	unbind_evtchn(Int_val(v_port));
+	bound_ports_remove(Int_val(v_port));
 	CAMLreturn(Val_unit);
 }
@@ -96,16 +96,16 @@ gnttab_end_transfer(grant_ref_t ref)
 /* An Io_page is an OCaml bigarray value with CAML_BA_MANAGED. If this has a
  * proxy set, then that points to the *base* of the data, and the array->data
  * is a pointer into a sub-view of that.
- * The grant functions always grant the base page rather than the current
- * view, since grants have to be page-aligned */
+ * The grant functions grant the page holding the start of the current view,
+ * since grants have to be page-aligned. This is the base page for views
+ * into a single page, and the right page for one page of a larger block
+ * (see Io_page.page), where the proxy's base would be the block's first. */
 
 static void *
 base_page_of(value v_iopage)
 {
     struct caml_ba_array *a = (struct caml_ba_array *)Caml_ba_array_val(v_iopage);
-    void *page = (a->proxy == NULL) ? a->data : a->proxy->data;
-    ASSERT(((unsigned long)page) % PAGE_SIZE == 0);
-    return page;
+    return (void *)((unsigned long)a->data & PAGE_MASK);
 }
 
 CAMLprim value
@@ -127,7 +127,6 @@ caml_gnttab_map(value v_ref, value v_iopage, value v_domid, value v_readonly)
       caml_failwith("caml_gnttab_map");
     }
 
-    printk("GNTTABOP_map_grant_ref mapped to %x\n", op.host_addr);
     CAMLreturn(Val_int(op.handle));
 }
 
@@ -151,6 +150,105 @@ caml_gnttab_unmap(value v_handle)
   CAMLreturn(Val_unit);
 }
 
+/* Number of operations passed to a single GNTTABOP hypercall by the
+   vectored stubs below */
+#define GNTTAB_BATCH 32
+
+/* Unmap the handles v_handles.(from) .. v_handles.(to - 1), returning the
+   number which failed */
+static int
+gnttab_unmap_batch(value v_handles, int from, int to)
+{
+    struct gnttab_unmap_grant_ref ops[GNTTAB_BATCH];
+    int i, n, failed = 0;
+
+    while (from < to) {
+      n = (to - from < GNTTAB_BATCH) ? to - from : GNTTAB_BATCH;
+      for (i = 0; i < n; i++) {
+        ops[i].host_addr = 0;
+        ops[i].dev_bus_addr = 0;
+        ops[i].handle = Int_val(Field(v_handles, from + i));
+      }
+      HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, ops, n);
+      for (i = 0; i < n; i++)
+        if (ops[i].status != GNTST_okay) {
+          printk("GNTTABOP_unmap_grant_ref handle = %x failed with status = %d\n",
+                 ops[i].handle, ops[i].status);
+          failed++;
+        }
+      from += n;
+    }
+    return failed;
+}
+
+/* Map the grants [v_refs.(i)] from [v_domids.(i)] onto consecutive pages
+   of [v_iopage], GNTTAB_BATCH at a time. Returns the array of handles.
+   If any map fails, the ones which succeeded are unmapped again and
+   Failure is raised. */
+CAMLprim value
+caml_gnttab_mapv(value v_refs, value v_domids, value v_iopage, value v_readonly)
+{
+    CAMLparam4(v_refs, v_domids, v_iopage, v_readonly);
+    CAMLlocal1(v_handles);
+    struct gnttab_map_grant_ref ops[GNTTAB_BATCH];
+    unsigned long base = (unsigned long) base_page_of(v_iopage);
+    int count = Wosize_val(v_refs);
+    int done = 0, failed = -1;
+    int i, n;
+
+    if (Wosize_val(v_domids) != Wosize_val(v_refs) ||
+        Caml_ba_array_val(v_iopage)->dim[0] < (intnat)(count * PAGE_SIZE))
+      caml_invalid_argument("caml_gnttab_mapv");
+    v_handles = caml_alloc_tuple(count);
+    for (i = 0; i < count; i++)
+      Field(v_handles, i) = Val_int(0);
+
+    while (done < count) {
+      n = (count - done < GNTTAB_BATCH) ? count - done : GNTTAB_BATCH;
+      for (i = 0; i < n; i++) {
+        ops[i].ref = Int_val(Field(v_refs, done + i));
+        ops[i].dom = Int_val(Field(v_domids, done + i));
+        ops[i].host_addr = base + (unsigned long)(done + i) * PAGE_SIZE;
+        ops[i].flags = GNTMAP_host_map;
+        if (Bool_val(v_readonly)) ops[i].flags |= GNTMAP_readonly;
+      }
+      HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, ops, n);
+      for (i = 0; i < n; i++) {
+        if (ops[i].status == GNTST_okay)
+          Field(v_handles, done + i) = Val_int(ops[i].handle);
+        else if (failed < 0) {
+          printk("GNTTABOP_map_grant_ref ref = %d domid = %d failed with status = %d\n",
+                 ops[i].ref, ops[i].dom, ops[i].status);
+          failed = done + i;
+        }
+      }
+      if (failed >= 0) {
+        /* Unmap everything before this batch, then the successes in it */
+        gnttab_unmap_batch(v_handles, 0, done);
+        for (i = 0; i < n; i++)
+          if (ops[i].status == GNTST_okay)
+            gnttab_unmap_batch(v_handles, done + i, done + i + 1);
+        caml_failwith("caml_gnttab_mapv");
+      }
+      done += n;
+    }
+
+    CAMLreturn(v_handles);
+}
+
+/* Unmap an array of handles returned by caml_gnttab_mapv. All of them
+   are attempted; Failure is raised afterwards if any did not unmap. */
+CAMLprim value
+caml_gnttab_unmapv(value v_handles)
+{
+    CAMLparam1(v_handles);
+    int failed = gnttab_unmap_batch(v_handles, 0, Wosize_val(v_handles));
+
+    if (failed)
+      caml_failwith("Failed to unmap grant.");
+    CAMLreturn(Val_unit);
+}
+
 CAMLprim value
 caml_gnttab_grant_access(value v_ref, value v_iopage, value v_domid, value v_readonly)
 {
@@ -160,6 +258,24 @@ caml_gnttab_grant_access(value v_ref, value v_iopage, value v_domid, value v_rea
     return Val_unit;
 }
 
+/* Grant page i of [v_iopage] through the i-th reference of [v_refs], so a
+   contiguous block can be shared without a bigarray per page. */
+CAMLprim value
+caml_gnttab_grant_accessv(value v_refs, value v_iopage, value v_domid, value v_readonly)
+{
+    unsigned long base = (unsigned long) base_page_of(v_iopage);
+    int count = Wosize_val(v_refs);
+    int i;
+
+    if (Caml_ba_array_val(v_iopage)->dim[0] < (intnat)(count * PAGE_SIZE))
+      caml_invalid_argument("caml_gnttab_grant_accessv");
+    for (i = 0; i < count; i++)
+      gnttab_grant_access(Int_val(Field(v_refs, i)),
+                          (void *)(base + (unsigned long)i * PAGE_SIZE),
+                          Int_val(v_domid), Bool_val(v_readonly));
+    return Val_unit;
+}
+
 CAMLprim value
 caml_gnttab_end_access(value v_ref)
 {
@@ -16,34 +16,152 @@
 
 #include <mini-os/x86/os.h>
 #include <mini-os/sched.h>
+#include <mini-os/events.h>
+#include <mini-os/time.h>
 
 #include <caml/mlvalues.h>
 #include <caml/memory.h>
 #include <caml/callback.h>
+#include <caml/alloc.h>
 
 void _exit(int);
 int errno;
 static char *argv[] = { "mirage", NULL };
 static unsigned long irqflags;
 
-/* TODO: make dynamic when binding/unbinding ports */
-static evtchn_port_t ports[] = { 1,2,3,4,5,6,7,8,9,10 };
 
-void evtchn_poll(void);
+/* Xen refuses to poll on more ports than this */
+#define MAX_POLL_PORTS 128
+/* Ports beyond MAX_POLL_PORTS are only noticed on timeout */
+#define OVERFLOW_TIMEOUT 10000000 /* 10ms */
 
 static struct sched_poll sched_poll;
-static s_time_t block_secs;
 
+/* Adaptive busy-polling: before blocking, spin on the pending bits of
+   the bound ports for up to [budget] ns. The budget follows twice the
+   running average of the time from going idle to the next event, and
+   drops to zero while that exceeds the [max] set from OCaml, so quiet
+   domains stay blocked and busy ones skip the hypercall round trip. */
+static struct {
+  s_time_t max;         /* ceiling in ns, 0 disables spinning */
+  s_time_t budget;      /* current spin budget in ns */
+  s_time_t avg_wait;    /* EWMA of idle-to-event time in ns */
+  unsigned long polls;  /* idle periods that started by spinning */
+  unsigned long hits;   /* events caught while spinning */
+  unsigned long blocks; /* SCHEDOP_poll hypercalls */
+  unsigned long wakeups;/* blocks ended by an event, not the timeout */
+} busy;
+
+#define BUSY_AVG_SHIFT 3  /* EWMA weight of 1/8 for each new sample */
+
+static int
+ports_pending(evtchn_port_t *ports, unsigned int nr_ports)
+{
+  shared_info_t *s = HYPERVISOR_shared_info;
+  unsigned int i;
+  for (i = 0; i < nr_ports; i++)
+    if (synch_test_bit(ports[i], &s->evtchn_pending[0]))
+      return 1;
+  return 0;
+}
+
+static void
+busy_sample(s_time_t wait)
+{
+  busy.avg_wait += (wait - busy.avg_wait) >> BUSY_AVG_SHIFT;
+  if (busy.avg_wait > busy.max)
+    busy.budget = 0;
+  else if (2 * busy.avg_wait > busy.max)
+    busy.budget = busy.max;
+  else
+    busy.budget = 2 * busy.avg_wait;
+}
+
+/* Spin until a bound port is pending or [until] is reached. Returns 1
+   if an event arrived. */
+static int
+busy_spin(evtchn_port_t *ports, unsigned int nr_ports, s_time_t until)
+{
+  do {
+    if (ports_pending(ports, nr_ports))
+      return 1;
+    __asm__ __volatile__("rep;nop" ::: "memory");
+  } while (clock_elapsed() < until);
+  return 0;
+}
+
+/* Block until an event arrives on a bound port or [v_deadline], in
+   nanoseconds of Clock.elapsed_ns, is reached. Neither allocates nor
+   raises, so OCaml declares it "noalloc". */
 CAMLprim value
-caml_block_domain(value v_timeout)
+caml_block_domain(value v_deadline)
 {
-  CAMLparam1(v_timeout);
-  block_secs = (s_time_t)(Double_val(v_timeout) * 1000000000);
+  evtchn_port_t *ports;
+  unsigned int nr_ports = evtchn_bound_ports(&ports);
+  s_time_t now = clock_elapsed();
+  s_time_t start = now;
+  s_time_t deadline = Long_val(v_deadline);
+  if (deadline < now)
+    deadline = now;
+  if (nr_ports > MAX_POLL_PORTS) {
+    nr_ports = MAX_POLL_PORTS;
+    if (deadline - now > OVERFLOW_TIMEOUT)
+      deadline = now + OVERFLOW_TIMEOUT;
+  }
+  if (busy.max > 0) {
+    /* With the budget at zero, still peek once so the average keeps
+       learning from events that are already waiting */
+    s_time_t until = now + busy.budget;
+    if (until > deadline)
+      until = deadline;
+    busy.polls++;
+    if (busy_spin(ports, nr_ports, until)) {
+      busy.hits++;
+      busy_sample(clock_elapsed() - start);
+      return Val_unit;
+    }
+    now = clock_elapsed();
+    if (now >= deadline)
+      return Val_unit;
+  }
   set_xen_guest_handle(sched_poll.ports, ports);
-  sched_poll.nr_ports = sizeof(ports) / sizeof(evtchn_port_t);
-  sched_poll.timeout = NOW() + block_secs;
+  sched_poll.nr_ports = nr_ports;
+  /* Never 0, which would mean no timeout at all */
+  sched_poll.timeout = clock_elapsed_to_system(deadline);
+  busy.blocks++;
   HYPERVISOR_sched_op(SCHEDOP_poll, &sched_poll);
-  CAMLreturn(Val_unit);
+  if (ports_pending(ports, nr_ports)) {
+    busy.wakeups++;
+    if (busy.max > 0)
+      busy_sample(clock_elapsed() - start);
+  }
+  return Val_unit;
+}
+
+/* Set the busy-poll ceiling in microseconds; 0 turns spinning off */
+CAMLprim value
+caml_busy_poll_set(value v_us)
+{
+  s_time_t max = (s_time_t)Long_val(v_us) * 1000;
+  busy.max = max > 0 ? max : 0;
+  busy.budget = busy.max;
+  busy.avg_wait = 0;
+  return Val_unit;
+}
+
+/* (polls, hits, blocks, wakeups, budget in microseconds) */
+CAMLprim value
+caml_busy_poll_stats(value v_unit)
+{
+  CAMLparam1(v_unit);
+  CAMLlocal1(v_ret);
+  v_ret = caml_alloc_tuple(5);
+  Store_field(v_ret, 0, Val_long(busy.polls));
+  Store_field(v_ret, 1, Val_long(busy.hits));
+  Store_field(v_ret, 2, Val_long(busy.blocks));
+  Store_field(v_ret, 3, Val_long(busy.wakeups));
+  Store_field(v_ret, 4, Val_long(busy.budget / 1000));
+  CAMLreturn(v_ret);
 }
 
 #define CAML_ENTRYPOINT "OS.Main.run"
@@ -139,8 +139,28 @@ struct chunk_tail_st {
 #define FREELIST_SIZE ((sizeof(void*)<<3)-PAGE_SHIFT)
 static chunk_head_t *free_head[FREELIST_SIZE];
 static chunk_head_t  free_tail[FREELIST_SIZE];
+/* Number of chunks on each list. */
+static unsigned long free_count[FREELIST_SIZE];
 #define FREELIST_EMPTY(_l) ((_l)->next == NULL)
 
+/*
+ * Recently freed single pages, handed straight back out by alloc_pages(0)
+ * without walking the buddy lists. They stay marked allocated in the
+ * bitmap, so they are not merged while cached. There is a single vCPU,
+ * hence a single cache.
+ */
+#define PAGE_CACHE_SIZE 64
+static unsigned long page_cache[PAGE_CACHE_SIZE];
+static unsigned int page_cache_nr;
+static void free_pages_buddy(void *pointer, int order);
+
+/* Give the cached pages back to the buddy lists so they can merge. */
+static void page_cache_flush(void)
+{
+    while ( page_cache_nr != 0 )
+        free_pages_buddy((void *)page_cache[--page_cache_nr], 0);
+}
+
 #define round_pgdown(_p)  ((_p)&PAGE_MASK)
 #define round_pgup(_p)    (((_p)+(PAGE_SIZE-1))&PAGE_MASK)
 
@@ -212,7 +232,9 @@ static void init_page_allocator(unsigned long min, unsigned long max)
         free_head[i]       = &free_tail[i];
         free_tail[i].pprev = &free_head[i];
         free_tail[i].next  = NULL;
+        free_count[i]      = 0;
     }
+    page_cache_nr = 0;
 
     min = round_pgup  (min);
     max = round_pgdown(max);
@@ -254,17 +276,24 @@ static void init_page_allocator(unsigned long min, unsigned long max)
         ch->next->pprev = &ch->next;
         free_head[i]    = ch;
         ct->level       = i;
+        free_count[i]++;
     }
 }
 
 
-/* Allocate 2^@order contiguous pages. Returns a VIRTUAL address. */
+/*
+ * Allocate 2^@order contiguous pages. Returns a VIRTUAL address, aligned
+ * on 2^@order pages: an order SUPERPAGE_SHIFT chunk can be mapped with a
+ * single superpage.
+ */
 unsigned long alloc_pages(int order)
 {
     int i;
     chunk_head_t *alloc_ch, *spare_ch;
     chunk_tail_t            *spare_ct;
 
+    if ( order == 0 && page_cache_nr != 0 )
+        return page_cache[--page_cache_nr];
 
     /* Find smallest order which can satisfy the request. */
     for ( i = order; i < FREELIST_SIZE; i++ ) {
@@ -272,12 +301,22 @@ unsigned long alloc_pages(int order)
         break;
     }
 
+    if ( i == FREELIST_SIZE && page_cache_nr != 0 )
+    {
+        /* The cached pages may complete a larger chunk. */
+        page_cache_flush();
+        for ( i = order; i < FREELIST_SIZE; i++ )
+            if ( !FREELIST_EMPTY(free_head[i]) )
+                break;
+    }
+
     if ( i == FREELIST_SIZE ) goto no_memory;
  
     /* Unlink a chunk. */
     alloc_ch = free_head[i];
     free_head[i] = alloc_ch->next;
     alloc_ch->next->pprev = alloc_ch->pprev;
+    free_count[i]--;
 
     /* We may have to break the chunk a number of times. */
     while ( i != order )
@@ -296,6 +335,7 @@ unsigned long alloc_pages(int order)
         /* Link in the spare chunk. */
         spare_ch->next->pprev = &spare_ch->next;
         free_head[i] = spare_ch;
+        free_count[i]++;
     }
     
     map_alloc(PHYS_PFN(to_phys(alloc_ch)), 1UL<<order);
@@ -310,6 +350,16 @@ unsigned long alloc_pages(int order)
 }
 
 void free_pages(void *pointer, int order)
+{
+    if ( order == 0 && page_cache_nr < PAGE_CACHE_SIZE )
+    {
+        page_cache[page_cache_nr++] = (unsigned long)pointer;
+        return;
+    }
+    free_pages_buddy(pointer, order);
+}
+
+static void free_pages_buddy(void *pointer, int order)
 {
     chunk_head_t *freed_ch, *to_merge_ch;
     chunk_tail_t *freed_ct;
@@ -350,6 +400,7 @@ void free_pages(void *pointer, int order)
         /* We are commited to merging, unlink the chunk */
         *(to_merge_ch->pprev) = to_merge_ch->next;
         to_merge_ch->next->pprev = to_merge_ch->pprev;
+        free_count[order]--;
         
         order++;
     }
@@ -362,7 +413,56 @@ void free_pages(void *pointer, int order)
     
     freed_ch->next->pprev = &freed_ch->next;
     free_head[order] = freed_ch;   
-   
+    free_count[order]++;
+}
+
+/* Number of free chunks of exactly 2^@order pages. */
+unsigned long free_chunks(int order)
+{
+    if ( order < 0 || order >= FREELIST_SIZE )
+        return 0;
+    return free_count[order];
+}
+
+/* Number of free pages, including the order-0 cache. */
+unsigned long total_free_pages(void)
+{
+    unsigned long pages = page_cache_nr;
+    int i;
+
+    for ( i = 0; i < FREELIST_SIZE; i++ )
+        pages += free_count[i] << i;
+    return pages;
+}
+
+/* Order of the largest free chunk, or -1 if there is none. */
+int largest_free_order(void)
+{
+    int i;
+
+    for ( i = FREELIST_SIZE - 1; i >= 0; i-- )
+        if ( free_count[i] != 0 )
+            return i;
+    return page_cache_nr != 0 ? 0 : -1;
+}
+
+/*
+ * Fragmentation index for requests of 2^@order pages: the share of free
+ * memory, in thousandths, held in chunks too small to satisfy them.
+ * 0 means every free page is usable, 1000 that none is.
+ */
+unsigned int fragmentation_index(int order)
+{
+    unsigned long total = total_free_pages(), unusable = page_cache_nr;
+    int i;
+
+    if ( total == 0 )
+        return 1000;
+    if ( order == 0 )
+        return 0;
+    for ( i = 0; i < order && i < FREELIST_SIZE; i++ )
+        unusable += free_count[i] << i;
+    return (unsigned int)((unusable * 1000) / total);
 }
 
 int free_physical_pages(xen_pfn_t *mfns, int n)
@@ -420,7 +520,7 @@ void sanity_check(void)
 int allocate_va_mapping(unsigned long va, unsigned long nr_pages, int superpages)
 {
     int i;
-    int order = superpages ? 9:0;
+    int order = superpages ? SUPERPAGE_SHIFT : 0;
 
     if (va & ((1UL<<order)<<PAGE_SHIFT)-1)
         return -EINVAL;
@@ -16,6 +16,7 @@
 
 #include <string.h>
 #include <mini-os/x86/os.h>
+#include <mini-os/mm.h>
 
 #include <caml/mlvalues.h>
 #include <caml/memory.h>
@@ -24,23 +25,228 @@
 #include <caml/fail.h>
 #include <caml/bigarray.h>
 
-/* Allocate a page-aligned bigarray of length [n_pages] pages.
-   Since CAML_BA_MANAGED is set the bigarray C finaliser will
-   call free() whenever all sub-bigarrays are unreachable.
+/* Free blocks of up to 2^POOL_MAX_ORDER pages are kept on per-order
+   lists rather than handed back to the page allocator, so that the
+   steady stream of pages allocated and collected for network and block
+   I/O does not go through mm.c each time. A free block is linked
+   through its first word. Larger blocks bypass the pool. */
+#define POOL_MAX_ORDER 4
+
+struct pool_block {
+  struct pool_block *next;
+};
+
+struct page_pool {
+  struct pool_block *head;
+  unsigned long nr_free;
+  unsigned long low;     /* blocks to stock up to when the list runs dry */
+  unsigned long high;    /* blocks above which frees go back to mm.c */
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long released;
+};
+
+static struct page_pool pools[POOL_MAX_ORDER + 1] = {
+  [0] = { .low = 32, .high = 1024 },
+  [1] = { .low = 8, .high = 128 },
+  [2] = { .low = 4, .high = 64 },
+  [3] = { .low = 2, .high = 32 },
+  [4] = { .low = 1, .high = 16 },
+};
+
+static void
+pool_push(struct page_pool *p, void *block)
+{
+  struct pool_block *b = block;
+  b->next = p->head;
+  p->head = b;
+  p->nr_free++;
+}
+
+static void *
+pool_pop(struct page_pool *p)
+{
+  struct pool_block *b = p->head;
+  p->head = b->next;
+  p->nr_free--;
+  return b;
+}
+
+/* Give every pooled block back to the page allocator */
+static void
+pool_drain(void)
+{
+  int order;
+  for (order = 0; order <= POOL_MAX_ORDER; order++)
+    while (pools[order].head != NULL) {
+      free_pages(pool_pop(&pools[order]), order);
+      pools[order].released++;
+    }
+}
+
+static void *
+pool_alloc(int order)
+{
+  struct page_pool *p;
+  void *block;
+
+  if (order > POOL_MAX_ORDER) {
+    block = (void *)alloc_pages(order);
+    if (block == NULL) {
+      pool_drain();
+      block = (void *)alloc_pages(order);
+    }
+    return block;
+  }
+
+  p = &pools[order];
+  if (p->head != NULL) {
+    p->hits++;
+    return pool_pop(p);
+  }
+  p->misses++;
+  block = (void *)alloc_pages(order);
+  if (block == NULL) {
+    pool_drain();
+    return (void *)alloc_pages(order);
+  }
+  /* Refill in one go, the next requests are likely to follow */
+  while (p->nr_free + 1 < p->low) {
+    void *spare = (void *)alloc_pages(order);
+    if (spare == NULL)
+      break;
+    pool_push(p, spare);
+  }
+  return block;
+}
+
+static void
+pool_free(void *block, int order)
+{
+  struct page_pool *p;
+
+  if (order > POOL_MAX_ORDER) {
+    free_pages(block, order);
+    return;
+  }
+  p = &pools[order];
+  if (p->nr_free >= p->high) {
+    free_pages(block, order);
+    p->released++;
+  } else
+    pool_push(p, block);
+}
+
+/* Io_page bigarrays are flagged CAML_BA_MAPPED_FILE, which has no other
+   use here, so that the bigarray finaliser hands their data back
+   through this function rather than free(). */
+void
+caml_ba_unmap_file(void *addr, uintnat len)
+{
+  pool_free(addr, get_order(len));
+}
+
+/* Bytes of Io_page memory the major GC may leave pinned before it is
+   made to work harder. Page data lives outside the OCaml heap, so
+   without this the GC only sees the small bigarray headers and lets
+   unreachable pages pile up. Zero means a quarter of the domain. */
+static unsigned long gc_budget;
+
+static void
+account_pages(size_t len)
+{
+  if (gc_budget == 0)
+    gc_budget = start_info.nr_pages * PAGE_SIZE / 4;
+  caml_adjust_gc_speed(len, gc_budget);
+}
+
+CAMLprim value
+caml_io_page_set_gc_budget(value v_pages)
+{
+  if (Long_val(v_pages) < 1)
+    caml_invalid_argument("caml_io_page_set_gc_budget");
+  gc_budget = Long_val(v_pages) * PAGE_SIZE;
+  return Val_unit;
+}
+
+/* Allocate a page-aligned bigarray of length [n_pages] pages from the
+   pool. The bigarray finaliser returns it through caml_ba_unmap_file
+   whenever all sub-bigarrays are unreachable.
  */
 CAMLprim value
 caml_alloc_pages(value n_pages)
 {
   CAMLparam1(n_pages);
+  CAMLlocal1(v_ba);
+  static char no_data;
+  struct caml_ba_array *ba;
   size_t len = Int_val(n_pages) * PAGE_SIZE;
-  /* If the allocation fails, return None. The ocaml layer will
+  void *block;
+
+  /* The header first, as an empty external array, since allocating it
+     may raise: the block would then be lost to the pool, and already
+     charged to the GC. */
+  v_ba = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_EXTERNAL, 1, &no_data, 0);
+  /* If the allocation fails, raise Failure. The ocaml layer will
      be able to trigger a full GC which just might run finalizers
      of unused bigarrays which will free some memory. */
-  void* block = memalign(PAGE_SIZE, len);
-
+  block = pool_alloc(get_order(len));
   if (block == NULL) {
-    printk("memalign(%d, %d) failed.\n", PAGE_SIZE, len);
-    caml_failwith("memalign");
+    printk("caml_alloc_pages(%d) failed.\n", Int_val(n_pages));
+    caml_failwith("caml_alloc_pages");
+  }
+  ba = Caml_ba_array_val(v_ba);
+  ba->data = block;
+  ba->dim[0] = len;
+  ba->flags = (ba->flags & ~CAML_BA_MANAGED_MASK) | CAML_BA_MAPPED_FILE;
+  account_pages(len);
+  CAMLreturn(v_ba);
+}
+
+/* Return [| free blocks; hits; misses; released; low; high |] for the
+   pool of blocks of 2^order pages */
+CAMLprim value
+caml_io_page_pool_stats(value v_order)
+{
+  CAMLparam1(v_order);
+  CAMLlocal1(v_stats);
+  int order = Int_val(v_order);
+  struct page_pool *p;
+
+  if (order < 0 || order > POOL_MAX_ORDER)
+    caml_invalid_argument("caml_io_page_pool_stats");
+  p = &pools[order];
+  v_stats = caml_alloc_tuple(6);
+  Store_field(v_stats, 0, Val_long(p->nr_free));
+  Store_field(v_stats, 1, Val_long(p->hits));
+  Store_field(v_stats, 2, Val_long(p->misses));
+  Store_field(v_stats, 3, Val_long(p->released));
+  Store_field(v_stats, 4, Val_long(p->low));
+  Store_field(v_stats, 5, Val_long(p->high));
+  CAMLreturn(v_stats);
+}
+
+CAMLprim value
+caml_io_page_pool_set_watermarks(value v_order, value v_low, value v_high)
+{
+  int order = Int_val(v_order);
+  struct page_pool *p;
+
+  if (order < 0 || order > POOL_MAX_ORDER || Long_val(v_low) < 0 ||
+      Long_val(v_high) < Long_val(v_low))
+    caml_invalid_argument("caml_io_page_pool_set_watermarks");
+  p = &pools[order];
+  p->low = Long_val(v_low);
+  p->high = Long_val(v_high);
+  while (p->nr_free > p->high) {
+    free_pages(pool_pop(p), order);
+    p->released++;
   }
-  CAMLreturn(caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED, 1, block, len));
+  return Val_unit;
+}
+
+CAMLprim value
+caml_io_page_pool_max_order(value v_unit)
+{
+  return Val_int(POOL_MAX_ORDER);
 }
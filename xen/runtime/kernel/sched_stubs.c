@@ -13,6 +13,8 @@
  */
 
 #include <mini-os/x86/os.h>
+#include <mini-os/events.h>
+#include <mini-os/time.h>
 
 #include <caml/mlvalues.h>
 #include <caml/memory.h>
@@ -54,6 +56,9 @@ stub_hypervisor_suspend(value unit)
   xen_info->store_mfn = mfn_to_pfn(xen_info->store_mfn);
   xen_info->console.domU.mfn = mfn_to_pfn(xen_info->console.domU.mfn);
 
+  /* Time stops while suspended, as far as Clock.elapsed_ns is concerned */
+  clock_suspend();
+
   /* canonicalize_pagetables can't cope with pagetable entries that are outside of the guest's mfns,
      so we must unmap anything outside of our space */
   unmap_shared_info();
@@ -78,10 +83,12 @@ stub_hypervisor_suspend(value unit)
 						   (unsigned long)failsafe_callback, 0);
 
   init_time();
+  clock_resume();
   arch_rebuild_p2m();
 
   unmask_evtchn(start_info.console.domU.evtchn);
   unmask_evtchn(start_info.store_evtchn);
+  evtchn_bound_ports_reset();
 
   CAMLreturn(Val_int(cancelled));
 }
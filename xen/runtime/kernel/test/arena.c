@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* The mm.c buddy allocator, running on a malloc'd arena */
+
+#include "../mm.c"
+#include "arena.h"
+
+unsigned long hosted_arena_base;
+int hosted_quiet;
+struct hosted_start_info start_info;
+
+void
+hosted_arena_init(unsigned long nr_pages)
+{
+    static void *arena;
+    size_t size = nr_pages << PAGE_SHIFT, align = PAGE_SIZE;
+
+    /* The buddy merges test the alignment of virtual addresses, which
+       on mini-os is that of physical ones: the whole arena has to be
+       aligned as a chunk of its size would be. */
+    while (align < size)
+        align <<= 1;
+    free(arena);
+    arena = aligned_alloc(align, align);
+    assert(arena != NULL);
+    hosted_arena_base = (unsigned long)arena;
+    start_info.nr_pages = nr_pages;
+    init_page_allocator(0, size);
+}
+
+int HYPERVISOR_memory_op(int cmd, void *arg) { abort(); }
+void arch_init_mm(unsigned long *start_pfn_p, unsigned long *max_pfn_p) { abort(); }
+void arch_init_p2m(unsigned long max_pfn_p) { abort(); }
+void arch_init_demand_mapping_area(unsigned long max_pfn) { abort(); }
+unsigned long alloc_contig_pages(int order, unsigned int addr_bits) { abort(); }
+void do_map_frames(unsigned long addr,
+        unsigned long *f, unsigned long n, unsigned long stride,
+        unsigned long increment, domid_t id, int may_fail, unsigned long prot)
+{
+    abort();
+}
+void *need_pgt(unsigned long addr, int a, int b) { abort(); }
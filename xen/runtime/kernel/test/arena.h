@@ -0,0 +1,14 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/* (Re)start the mm.c page allocator on a fresh arena of [nr_pages]
+   pages. Its first page holds the allocation bitmap. */
+void hosted_arena_init(unsigned long nr_pages);
+
+/* Silences printk while set */
+extern int hosted_quiet;
+
+/* mm.c's own consistency check of the free lists */
+void sanity_check(void);
+
+#endif /* _ARENA_H_ */
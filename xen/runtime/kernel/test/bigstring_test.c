@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The Bigstring primitives of runtime/ocaml/cstruct_stubs.c and the
+ * Cstruct word accesses of runtime/ocaml/barrier_stubs.c, against byte
+ * by byte references at random offsets, including unaligned ones.
+ */
+
+#include <stdio.h>
+#include "values.h"
+#include "../../ocaml/cstruct_stubs.c"
+#include "../../ocaml/barrier_stubs.c"
+
+#define BUFSIZE    4096
+#define ITERATIONS 100000
+
+static unsigned char buf[BUFSIZE], copy[BUFSIZE];
+
+value
+caml_copy_int64(int64 i)
+{
+  value v = alloc_block(1 + sizeof(int64) / sizeof(value), Custom_tag);
+
+  memcpy(Data_custom_val(v), &i, sizeof(i));
+  return v;
+}
+
+/* The [bytes] bytes at [p] as an integer, most significant first if [be] */
+static uint64_t
+get(const unsigned char *p, int bytes, int be)
+{
+  uint64_t v = 0;
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    v |= (uint64_t) p[i] << (8 * (be ? bytes - 1 - i : i));
+  return v;
+}
+
+static void
+set(unsigned char *p, int bytes, int be, uint64_t v)
+{
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    p[i] = v >> (8 * (be ? bytes - 1 - i : i));
+}
+
+static uint64_t
+random64(void)
+{
+  return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+}
+
+static void
+randomise(void)
+{
+  int i;
+
+  for (i = 0; i < BUFSIZE; i++)
+    buf[i] = copy[i] = rand();
+}
+
+/* Loads and stores of every width and byte order */
+static void
+test_accessors(void)
+{
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    intnat ofs = rand() % (BUFSIZE - 8);
+    uint64_t x = random64();
+    int be = rand() % 2;
+    value ba;
+
+    values_reset();
+    ba = bigarray(buf, BUFSIZE);
+    randomise();
+    assert(Long_val(caml_bigstring_get_uint8(ba, Val_long(ofs))) == buf[ofs]);
+    if (be) {
+      assert(Long_val(caml_bigstring_get_uint16_be(ba, Val_long(ofs))) == get(buf + ofs, 2, 1));
+      assert(Long_val(caml_bigstring_get_uint32_be(ba, Val_long(ofs))) == get(buf + ofs, 4, 1));
+      assert((uint64_t) Int64_val(caml_bigstring_get_uint64_be(ba, Val_long(ofs))) == get(buf + ofs, 8, 1));
+    } else {
+      assert(Long_val(caml_bigstring_get_uint16_le(ba, Val_long(ofs))) == get(buf + ofs, 2, 0));
+      assert(Long_val(caml_bigstring_get_uint32_le(ba, Val_long(ofs))) == get(buf + ofs, 4, 0));
+      assert((uint64_t) Int64_val(caml_bigstring_get_uint64_le(ba, Val_long(ofs))) == get(buf + ofs, 8, 0));
+    }
+
+    /* Stores write their width and nothing else; upper bits of the
+       value are ignored */
+    switch (rand() % 4) {
+    case 0:
+      caml_bigstring_set_uint8(ba, Val_long(ofs), Val_long(x & 0xff));
+      set(copy + ofs, 1, be, x);
+      break;
+    case 1:
+      (be ? caml_bigstring_set_uint16_be : caml_bigstring_set_uint16_le)
+        (ba, Val_long(ofs), Val_long(x >> 2));
+      set(copy + ofs, 2, be, x >> 2);
+      break;
+    case 2:
+      (be ? caml_bigstring_set_uint32_be : caml_bigstring_set_uint32_le)
+        (ba, Val_long(ofs), Val_long(x >> 2));
+      set(copy + ofs, 4, be, x >> 2);
+      break;
+    default:
+      (be ? caml_bigstring_set_uint64_be : caml_bigstring_set_uint64_le)
+        (ba, Val_long(ofs), caml_copy_int64(x));
+      set(copy + ofs, 8, be, x);
+    }
+    assert(memcmp(buf, copy, BUFSIZE) == 0);
+  }
+  printf("loads and stores: ok\n");
+}
+
+/* fill, compare, index and blit against the C library */
+static void
+test_ranges(void)
+{
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    intnat ofs1 = rand() % BUFSIZE, ofs2 = rand() % BUFSIZE;
+    intnat len = rand() % (BUFSIZE - (ofs1 > ofs2 ? ofs1 : ofs2) + 1);
+    unsigned char c = rand() % 4;
+    unsigned char *p;
+    value ba;
+    int r;
+
+    values_reset();
+    ba = bigarray(buf, BUFSIZE);
+    randomise();
+    /* Few distinct bytes, so that ranges often match */
+    for (r = 0; r < BUFSIZE; r++)
+      buf[r] = copy[r] = buf[r] % 4;
+
+    r = memcmp(buf + ofs1, buf + ofs2, len);
+    assert(Int_val(caml_bigstring_compare(ba, Val_long(ofs1), ba, Val_long(ofs2), Val_long(len)))
+           == (r > 0) - (r < 0));
+
+    p = memchr(buf + ofs1, c, len);
+    assert(Long_val(caml_bigstring_index(ba, Val_long(ofs1), Val_long(len), Val_int(c)))
+           == (p ? p - buf : -1));
+
+    /* Overlapping blits move, as memmove does */
+    caml_blit_bigstring_to_bigstring(ba, Val_long(ofs1), ba, Val_long(ofs2), Val_long(len));
+    memmove(copy + ofs2, copy + ofs1, len);
+    assert(memcmp(buf, copy, BUFSIZE) == 0);
+
+    caml_bigstring_fill(ba, Val_long(ofs1), Val_long(len), Val_int(c));
+    memset(copy + ofs1, c, len);
+    assert(memcmp(buf, copy, BUFSIZE) == 0);
+  }
+  printf("fill, compare, index and blit: ok\n");
+}
+
+/* caml_cstruct_unsafe_{load,save}_uint32 c ofs access the native-order
+   word at byte c.off + ofs, ofs rounded down to a multiple of 4 */
+static void
+test_cstruct_words(void)
+{
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    intnat off = rand() % 64, ofs = rand() % (BUFSIZE - 64 - 4);
+    unsigned char *word = buf + off + (ofs & ~3);
+    uint64_t x = random64();
+    value cs;
+
+    values_reset();
+    cs = cstruct(bigarray(buf, BUFSIZE), off, BUFSIZE - off);
+    randomise();
+    assert((uint32_t) Long_val(caml_cstruct_unsafe_load_uint32(cs, Val_long(ofs)))
+           == get(word, 4, 0));
+    caml_cstruct_unsafe_save_uint32(cs, Val_long(ofs), Val_long(x >> 2));
+    set(copy + (word - buf), 4, 0, x >> 2);
+    assert(memcmp(buf, copy, BUFSIZE) == 0);
+  }
+  printf("cstruct words: ok\n");
+}
+
+int main() {
+  srand(1);
+  test_accessors();
+  test_ranges();
+  test_cstruct_words();
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Time of caml_ones_complement_checksum on one cstruct, from 64 bytes
+ * to 64KiB. With CHECKSUM_KERNELS there is a column per summing kernel,
+ * otherwise one for the stubs as they are. An older copy of the stubs
+ * can be timed with
+ * make clean bench CHECKSUM=/path/to/old/checksum_stubs.c CHECKSUM_FLAGS=
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "values.h"
+#include CHECKSUM_STUBS
+
+/* Bytes summed per size and column */
+#define VOLUME (256L << 20)
+
+static unsigned char buf[65536];
+
+static const size_t lengths[] = { 64, 128, 256, 576, 1500, 4096, 16384, 65536 };
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+time_sum(value cs, size_t len)
+{
+  long i, n = VOLUME / len;
+  volatile value sink;
+  double start = now();
+
+  for (i = 0; i < n; i++)
+    sink = caml_ones_complement_checksum(cs);
+  return (now() - start) / n;
+}
+
+#ifdef CHECKSUM_KERNELS
+#include "kernels.h"
+#define NR_COLUMNS NR_KERNELS
+#else
+#define NR_COLUMNS 1
+#endif
+
+int main() {
+  value ba = bigarray(buf, sizeof(buf));
+  unsigned int c, l;
+
+  srand(1);
+  for (l = 0; l < sizeof(buf); l++)
+    buf[l] = rand();
+  printf("%-8s", "ns");
+  for (c = 0; c < NR_COLUMNS; c++)
+#ifdef CHECKSUM_KERNELS
+    printf("%10s", kernels[c].name);
+#else
+    printf("%10s", "stubs");
+#endif
+  printf("\n");
+  for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+    value cs = cstruct(ba, 0, lengths[l]);
+
+    printf("%-8zu", lengths[l]);
+    for (c = 0; c < NR_COLUMNS; c++) {
+#ifdef CHECKSUM_KERNELS
+      if (!kernel_supported(c)) {
+        printf("%10s", "-");
+        continue;
+      }
+      kernel_select(c);
+#endif
+      printf("%10.1f", time_sum(cs, lengths[l]));
+    }
+    printf("\n");
+  }
+  return 0;
+}
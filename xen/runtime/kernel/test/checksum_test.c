@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The checksum stubs against a byte-at-a-time RFC 1071 sum, on random
+ * buffers, offsets, lengths and splits into lists; the copying variant
+ * against a blit followed by that sum; the RFC 1624 updates against a
+ * recomputation. CHECKSUM_STUBS names the copy of
+ * the stubs under test; with CHECKSUM_KERNELS, every summing kernel the
+ * CPU supports is tested in turn rather than the one picked. The ns3
+ * stubs take bigarrays rather than cstructs: CHECKSUM_BIGARRAYS.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "values.h"
+#include CHECKSUM_STUBS
+#ifdef CHECKSUM_KERNELS
+#include "kernels.h"
+#endif
+
+#define BUFSIZE    (65536 + 64)
+#define ITERATIONS 20000
+
+static unsigned char buf[BUFSIZE], dst[BUFSIZE];
+
+/* [len] bytes at [off] of [base], as the stubs take them */
+static value
+piece(unsigned char *base, size_t off, size_t len)
+{
+#ifdef CHECKSUM_BIGARRAYS
+  return bigarray(base + off, len);
+#else
+  return cstruct(bigarray(base, BUFSIZE), off, len);
+#endif
+}
+
+static uint16_t
+checksum(value p, size_t len)
+{
+#ifdef CHECKSUM_BIGARRAYS
+  return Int_val(caml_ones_complement_checksum(p, Val_long(len)));
+#else
+  return Int_val(caml_ones_complement_checksum(p));
+#endif
+}
+
+/* The checksum of [p, p + len), as read back from the packet */
+static uint16_t
+reference(const unsigned char *p, size_t len)
+{
+  uint32_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    sum += (i & 1) ? p[i] : p[i] << 8;
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+static size_t
+random_length(void)
+{
+  switch (rand() % 8) {
+  case 0:  return rand() % 65537;
+  case 1:  return rand() % 16;
+  default: return rand() % 2048;
+  }
+}
+
+/* [len] bytes at [off] of [base] as a list of 1 to 8 pieces, some of
+   them odd-sized or empty */
+static value
+split(unsigned char *base, size_t off, size_t len)
+{
+  size_t cuts[8];
+  int n = 1 + rand() % 8, i, j;
+  value l = Val_emptylist;
+
+  for (i = 0; i < n - 1; i++)
+    cuts[i] = len == 0 ? 0 : rand() % (len + 1);
+  cuts[n - 1] = len;
+  /* Sorted, so that the pieces cover [off, off + len) in order */
+  for (i = 1; i < n; i++)
+    for (j = i; j > 0 && cuts[j - 1] > cuts[j]; j--) {
+      size_t c = cuts[j];
+      cuts[j] = cuts[j - 1];
+      cuts[j - 1] = c;
+    }
+  for (i = n - 1; i >= 0; i--) {
+    size_t start = i == 0 ? 0 : cuts[i - 1];
+    l = cons(piece(base, off + start, cuts[i] - start), l);
+  }
+  return l;
+}
+
+static void
+test_sums(const char *kernel)
+{
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    size_t off = rand() % 64, len = random_length(), i;
+    uint16_t expected;
+
+    values_reset();
+    for (i = 0; i < len; i++)
+      buf[off + i] = rand();
+    /* Sums that wrap often */
+    if (n % 4 == 0)
+      memset(buf + off, 0xff, len);
+    expected = reference(buf + off, len);
+    if (checksum(piece(buf, off, len), len) != expected ||
+        Int_val(caml_ones_complement_checksum_list(split(buf, off, len))) != expected) {
+      fprintf(stderr, "%s: wrong sum of %zu bytes at offset %zu\n", kernel, len, off);
+      exit(1);
+    }
+  }
+  printf("%s: checksum and checksum_list ok\n", kernel);
+}
+
+/* caml_ones_complement_checksum_copy dst srcs is a blit of srcs into
+   dst followed by a sum, left uncomplemented, of what was blitted */
+static void
+test_copy(const char *kernel)
+{
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    size_t off = rand() % 64, len = random_length(), i;
+    size_t doff = rand() % 64, dlen = len + rand() % 3 - 1;
+    unsigned char sentinel = rand();
+    value srcs;
+    uint16_t sum;
+
+    values_reset();
+    for (i = 0; i < len; i++)
+      buf[off + i] = rand();
+    if (n % 4 == 0)
+      memset(buf + off, 0xff, len);
+    if (len == 0 || n % 16 != 0)
+      dlen = len + rand() % 64;
+    memset(dst, sentinel, BUFSIZE);
+    srcs = split(buf, off, len);
+
+    if (dlen < len) {
+      /* Too short: nothing is written */
+      if (setjmp(invalid_argument) == 0) {
+        caml_ones_complement_checksum_copy(piece(dst, doff, dlen), srcs);
+        fprintf(stderr, "%s: copy of %zu bytes into %zu did not fail\n", kernel, len, dlen);
+        exit(1);
+      }
+      for (i = 0; i < BUFSIZE; i++)
+        assert(dst[i] == sentinel);
+      continue;
+    }
+
+    sum = Int_val(caml_ones_complement_checksum_copy(piece(dst, doff, dlen), srcs));
+    if (memcmp(dst + doff, buf + off, len) != 0) {
+      fprintf(stderr, "%s: copy of %zu bytes differs from a blit\n", kernel, len);
+      exit(1);
+    }
+    for (i = 0; i < BUFSIZE; i++)
+      if (i < doff || i >= doff + len)
+        assert(dst[i] == sentinel);
+    if (sum != (uint16_t) ~reference(dst + doff, len)) {
+      fprintf(stderr, "%s: wrong sum of %zu bytes copied\n", kernel, len);
+      exit(1);
+    }
+  }
+  printf("%s: checksum_copy ok\n", kernel);
+}
+
+static uint16_t
+get16(const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static void
+set16(unsigned char *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+/* Rewriting a 16 or 32-bit field of an IPv4 header and updating its
+   checksum gives the checksum of the new header; a checksum taken with
+   a known partial sum is that of the whole. */
+static void
+test_update(const char *kernel)
+{
+  unsigned char hdr[20];
+  int n;
+
+  for (n = 0; n < ITERATIONS; n++) {
+    size_t i, field, split_at;
+    uint16_t csum, old, new;
+    uint32_t old32, new32;
+
+    values_reset();
+    for (i = 0; i < sizeof(hdr); i++)
+      hdr[i] = n % 4 == 0 ? 0xff : rand();
+    set16(hdr + 10, 0);
+    csum = reference(hdr, sizeof(hdr));
+    set16(hdr + 10, csum);
+
+    /* Any 16-bit field but the checksum, e.g. the TTL and protocol */
+    do
+      field = 2 * (rand() % 10);
+    while (field == 10);
+    old = get16(hdr + field);
+    new = rand();
+    set16(hdr + field, new);
+    csum = Int_val(caml_ones_complement_checksum_update16(
+                     Val_int(csum), Val_int(old), Val_int(new)));
+    set16(hdr + 10, 0);
+    if (csum != reference(hdr, sizeof(hdr))) {
+      fprintf(stderr, "%s: update16 of %04x to %04x at %zu is wrong\n", kernel, old, new, field);
+      exit(1);
+    }
+    set16(hdr + 10, csum);
+
+    /* The source or destination address */
+    field = rand() % 2 ? 12 : 16;
+    old32 = ((uint32_t) get16(hdr + field) << 16) | get16(hdr + field + 2);
+    new32 = ((uint32_t) rand() << 16) ^ rand();
+    set16(hdr + field, new32 >> 16);
+    set16(hdr + field + 2, new32);
+    csum = Int_val(caml_ones_complement_checksum_update32(
+                     Val_int(csum), boxed_int32(old32), boxed_int32(new32)));
+    set16(hdr + 10, 0);
+    if (csum != reference(hdr, sizeof(hdr))) {
+      fprintf(stderr, "%s: update32 of %08x to %08x is wrong\n", kernel, old32, new32);
+      exit(1);
+    }
+
+    /* An even prefix, as a pseudo-header would be, summed beforehand */
+    split_at = 2 * (rand() % 11);
+    memcpy(buf, hdr, sizeof(hdr));
+    if (Int_val(caml_ones_complement_checksum_list_with(
+                  Val_int((uint16_t) ~reference(buf, split_at)),
+                  split(buf, split_at, sizeof(hdr) - split_at))) !=
+        reference(buf, sizeof(hdr))) {
+      fprintf(stderr, "%s: list_with after %zu bytes is wrong\n", kernel, split_at);
+      exit(1);
+    }
+  }
+  printf("%s: update16, update32 and list_with ok\n", kernel);
+}
+
+static void
+test(void (*f)(const char *))
+{
+#ifdef CHECKSUM_KERNELS
+  unsigned int k;
+
+  for (k = 0; k < NR_KERNELS; k++) {
+    if (!kernel_supported(k)) {
+      printf("%s: not supported here\n", kernels[k].name);
+      continue;
+    }
+    kernel_select(k);
+    f(kernels[k].name);
+  }
+#else
+  f("stubs");
+#endif
+}
+
+int main() {
+  srand(1);
+  test(test_sums);
+  test(test_copy);
+  test(test_update);
+  return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The event dispatch of runtime/kernel/eventchn_stubs.c against a
+ * simulated shared info page: events are raised in it as Xen would,
+ * evtchn_poll moves them to the runtime's bitmap, and
+ * caml_evtchn_next_pending must then pop each port which fired, once,
+ * lowest first, however many times it fired and polls ran meanwhile.
+ */
+
+#include <stdio.h>
+#include "values.h"
+#include "../eventchn_stubs.c"
+
+#define ITERATIONS 20000
+
+static shared_info_t shared_info;
+shared_info_t *HYPERVISOR_shared_info = &shared_info;
+struct hosted_start_info start_info;
+
+/* Ports which fired since the last poll, and those a poll latched in
+   the runtime's bitmap which have not been popped yet */
+static char fired[NR_EVENT_CHANNELS], latched[NR_EVENT_CHANNELS];
+
+/* Xen's side of an event: the port is marked pending and, unless it is
+   masked, so is its word in the selector of the vcpu */
+static void
+raise_event(evtchn_port_t port)
+{
+  unsigned long word = port / LONG_BITS, bit = 1UL << (port % LONG_BITS);
+
+  shared_info.evtchn_pending[word] |= bit;
+  if (!(shared_info.evtchn_mask[word] & bit)) {
+    shared_info.vcpu_info[0].evtchn_pending_sel |= 1UL << word;
+    shared_info.vcpu_info[0].evtchn_upcall_pending = 1;
+    fired[port] = 1;
+  }
+}
+
+static int
+xen_pending(evtchn_port_t port)
+{
+  return !!(shared_info.evtchn_pending[port / LONG_BITS] & (1UL << (port % LONG_BITS)));
+}
+
+void
+clear_evtchn(uint32_t port)
+{
+  shared_info.evtchn_pending[port / LONG_BITS] &= ~(1UL << (port % LONG_BITS));
+}
+
+static void
+mask(evtchn_port_t port)
+{
+  shared_info.evtchn_mask[port / LONG_BITS] |= 1UL << (port % LONG_BITS);
+}
+
+void
+unmask_evtchn(uint32_t port)
+{
+  shared_info.evtchn_mask[port / LONG_BITS] &= ~(1UL << (port % LONG_BITS));
+}
+
+/* Binding hands out ports upwards from 10 */
+static evtchn_port_t next_port = 10;
+
+int evtchn_alloc_unbound(domid_t pal, evtchn_port_t *port) { *port = next_port++; return 0; }
+int evtchn_bind_virq(uint32_t virq, evtchn_port_t *port) { *port = next_port++; return 0; }
+int
+evtchn_bind_interdomain(domid_t pal, evtchn_port_t remote_port, evtchn_port_t *local_port)
+{
+  *local_port = next_port++;
+  return 0;
+}
+void unbind_evtchn(evtchn_port_t port) { }
+int notify_remote_via_evtchn(evtchn_port_t port) { return 0; }
+
+static void
+poll(void)
+{
+  unsigned int port;
+
+  evtchn_poll();
+  for (port = 0; port < NR_EVENT_CHANNELS; port++)
+    if (fired[port]) {
+      fired[port] = 0;
+      latched[port] = 1;
+    }
+}
+
+static long
+next_pending(void)
+{
+  return Long_val(caml_evtchn_next_pending(Val_unit));
+}
+
+/* Pop up to [n] ports, checking that they are those latched, in
+   increasing order */
+static void
+pop(int n)
+{
+  long port, last = -1;
+
+  while (n-- > 0 && (port = next_pending()) >= 0) {
+    assert(port > last && port < NR_EVENT_CHANNELS);
+    assert(latched[port]);
+    latched[port] = 0;
+    last = port;
+  }
+  /* Nothing latched below the last port popped is left */
+  for (port = 0; port < last; port++)
+    assert(!latched[port]);
+}
+
+static void
+pop_all(void)
+{
+  unsigned int port;
+
+  pop(NR_EVENT_CHANNELS);
+  assert(next_pending() == -1);
+  for (port = 0; port < NR_EVENT_CHANNELS; port++)
+    assert(!latched[port]);
+}
+
+/* A few ports by hand: the first of each word, one past it, the last
+   one, and one that fires twice */
+static void
+test_simple(void)
+{
+  static const evtchn_port_t ports[] = { 4095, 64, 0, 63, 65, 130, 3, 64 };
+  unsigned int i;
+
+  assert(NR_EVENT_CHANNELS == 4096);
+  for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+    raise_event(ports[i]);
+  evtchn_poll();
+  assert(shared_info.vcpu_info[0].evtchn_upcall_pending == 0);
+  assert(shared_info.vcpu_info[0].evtchn_pending_sel == 0);
+  for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+    assert(!xen_pending(ports[i]));
+  assert(next_pending() == 0);
+  assert(next_pending() == 3);
+  assert(next_pending() == 63);
+  assert(next_pending() == 64);
+  assert(next_pending() == 65);
+  assert(next_pending() == 130);
+  assert(next_pending() == 4095);
+  assert(next_pending() == -1);
+  memset(fired, 0, sizeof(fired));
+  memset(latched, 0, sizeof(latched));
+  printf("ports in order: ok\n");
+}
+
+/* A port which fired stays latched in the runtime's bitmap across
+   polls until it is popped, and firing again meanwhile does not pop it
+   twice; a masked port is left pending on the Xen side */
+static void
+test_latching(void)
+{
+  raise_event(200);
+  evtchn_poll();
+  evtchn_poll();
+  raise_event(200);
+  evtchn_poll();
+  raise_event(100);
+  assert(next_pending() == 200);
+  assert(next_pending() == -1);
+  /* 100 was raised after the last poll */
+  evtchn_poll();
+  assert(next_pending() == 100);
+  assert(next_pending() == -1);
+
+  mask(300);
+  raise_event(300);
+  raise_event(301);
+  evtchn_poll();
+  assert(xen_pending(300) && !xen_pending(301));
+  assert(next_pending() == 301);
+  assert(next_pending() == -1);
+  unmask_evtchn(300);
+  clear_evtchn(300);
+  memset(fired, 0, sizeof(fired));
+  memset(latched, 0, sizeof(latched));
+  printf("latching and masking: ok\n");
+}
+
+/* Random bursts of events, polls and partial pops against the set of
+   ports which fired */
+static void
+test_random(void)
+{
+  int n, i;
+
+  for (i = 0; i < 64; i++)
+    mask(rand() % NR_EVENT_CHANNELS);
+  for (n = 0; n < ITERATIONS; n++) {
+    int burst = rand() % 16;
+
+    for (i = 0; i < burst; i++) {
+      /* Clustered in a few words at times, spread out at others */
+      evtchn_port_t port = rand() % 2 ? rand() % 256 : rand() % NR_EVENT_CHANNELS;
+
+      raise_event(port);
+    }
+    if (rand() % 4)
+      poll();
+    pop(rand() % 8);
+  }
+  poll();
+  pop_all();
+  printf("random events: ok\n");
+}
+
+/* caml_block_domain polls on the ports bound through the stubs, plus
+   those of the console and xenstore */
+static void
+test_bound_ports(void)
+{
+  evtchn_port_t *ports;
+  value a, b;
+
+  start_info.console.domU.evtchn = 2;
+  start_info.store_evtchn = 1;
+  caml_evtchn_init(Val_unit);
+  assert(evtchn_bound_ports(&ports) == 2);
+  assert(ports[0] == 2 && ports[1] == 1);
+  a = stub_evtchn_alloc_unbound(Val_int(0));
+  b = stub_bind_virq(Val_int(VIRQ_DOM_EXC));
+  stub_evtchn_bind_interdomain(Val_int(0), Val_int(5));
+  assert(evtchn_bound_ports(&ports) == 5);
+  stub_evtchn_unbind(a);
+  stub_evtchn_unbind(b);
+  stub_evtchn_unbind(b);
+  assert(evtchn_bound_ports(&ports) == 3);
+  assert(ports[0] == 2 && ports[1] == 1 && ports[2] == 12);
+  evtchn_bound_ports_reset();
+  assert(evtchn_bound_ports(&ports) == 2);
+  printf("bound ports: ok\n");
+}
+
+int main() {
+  srand(1);
+  test_simple();
+  test_latching();
+  test_random();
+  test_bound_ports();
+  return 0;
+}
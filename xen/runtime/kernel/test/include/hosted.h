@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Just enough of the mini-os environment to build the allocators, page
+   and event channel stubs of runtime/kernel as ordinary Linux programs. Every mini-os
+   header they include resolves to this one. "Physical" memory is an
+   arena set up by the test: physical address 0 is hosted_arena_base. */
+
+#ifndef _HOSTED_H_
+#define _HOSTED_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1UL << PAGE_SHIFT)
+#define PAGE_MASK       (~(PAGE_SIZE-1))
+#define SUPERPAGE_SHIFT 9
+
+/* Tests which run out of memory on purpose set hosted_quiet */
+extern int hosted_quiet;
+#define printk(_f, _a...) \
+    do { if ( !hosted_quiet ) printf(_f, ## _a); } while (0)
+#define BUG()           abort()
+#define BUG_ON(x)       do { if (x) BUG(); } while (0)
+#define ASSERT(x)       assert(x)
+#define USED            __attribute__ ((used))
+
+extern unsigned long hosted_arena_base;
+
+#define to_phys(x)      ((unsigned long)(x) - hosted_arena_base)
+#define to_virt(x)      ((void *)((unsigned long)(x) + hosted_arena_base))
+#define PFN_PHYS(x)     ((unsigned long)(x) << PAGE_SHIFT)
+#define PHYS_PFN(x)     ((unsigned long)(x) >> PAGE_SHIFT)
+#define virt_to_pfn(v)  PHYS_PFN(to_phys(v))
+#define pfn_to_virt(p)  to_virt(PFN_PHYS(p))
+#define virt_to_mfn(v)  virt_to_pfn(v)
+
+unsigned long alloc_pages(int order);
+#define alloc_page()    alloc_pages(0)
+void free_pages(void *pointer, int order);
+#define free_page(p)    free_pages(p, 0)
+
+unsigned long free_chunks(int order);
+unsigned long total_free_pages(void);
+int largest_free_order(void);
+unsigned int fragmentation_index(int order);
+
+static __inline__ int get_order(unsigned long size)
+{
+    int order;
+    size = (size-1) >> PAGE_SHIFT;
+    for ( order = 0; size; order++ )
+        size >>= 1;
+    return order;
+}
+
+struct hosted_start_info {
+    unsigned long nr_pages;
+    uint32_t store_evtchn;
+    struct {
+        struct {
+            uint32_t evtchn;
+        } domU;
+    } console;
+};
+extern struct hosted_start_info start_info;
+
+/* What mm.c needs outside of the page allocator, none of which the
+   tests call; the functions abort if they are. */
+typedef unsigned short domid_t;
+typedef unsigned long xen_pfn_t;
+#define DOMID_SELF                  ((domid_t)0x7FF0U)
+#define XENMEM_decrease_reservation 1
+#define L1_PROT                     0
+#define _PAGE_PSE                   0
+#define set_xen_guest_handle(hnd, val) do { (hnd) = (val); } while (0)
+
+struct xen_memory_reservation {
+    xen_pfn_t *extent_start;
+    unsigned long nr_extents;
+    unsigned int extent_order;
+    domid_t domid;
+};
+
+int HYPERVISOR_memory_op(int cmd, void *arg);
+void arch_init_mm(unsigned long *start_pfn_p, unsigned long *max_pfn_p);
+void arch_init_p2m(unsigned long max_pfn_p);
+void arch_init_demand_mapping_area(unsigned long max_pfn);
+unsigned long alloc_contig_pages(int order, unsigned int addr_bits);
+void do_map_frames(unsigned long addr,
+        unsigned long *f, unsigned long n, unsigned long stride,
+        unsigned long increment, domid_t id, int may_fail, unsigned long prot);
+void *need_pgt(unsigned long addr, int a, int b);
+
+/* Event channels. The shared info page is a plain structure which the
+   tests fill in as Xen would; the hypercalls are left to them. */
+typedef uint32_t evtchn_port_t;
+#define NR_EVENT_CHANNELS (sizeof(unsigned long) * sizeof(unsigned long) * 64)
+#define VIRQ_DOM_EXC      3
+
+typedef struct vcpu_info {
+    uint8_t evtchn_upcall_pending;
+    unsigned long evtchn_pending_sel;
+} vcpu_info_t;
+
+typedef struct shared_info {
+    vcpu_info_t vcpu_info[1];
+    unsigned long evtchn_pending[sizeof(unsigned long) * 8];
+    unsigned long evtchn_mask[sizeof(unsigned long) * 8];
+} shared_info_t;
+
+extern shared_info_t *HYPERVISOR_shared_info;
+
+#define xchg(ptr, v)    __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST)
+
+static __inline__ unsigned long __ffs(unsigned long word)
+{
+    return __builtin_ctzl(word);
+}
+
+void clear_evtchn(uint32_t port);
+void unmask_evtchn(uint32_t port);
+int notify_remote_via_evtchn(evtchn_port_t port);
+int evtchn_alloc_unbound(domid_t pal, evtchn_port_t *port);
+int evtchn_bind_interdomain(domid_t pal, evtchn_port_t remote_port,
+                            evtchn_port_t *local_port);
+int evtchn_bind_virq(uint32_t virq, evtchn_port_t *port);
+void unbind_evtchn(evtchn_port_t port);
+
+#endif /* _HOSTED_H_ */
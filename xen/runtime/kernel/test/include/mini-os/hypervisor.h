@@ -0,0 +1 @@
+#include <hosted.h>
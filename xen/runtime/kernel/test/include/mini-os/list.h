@@ -0,0 +1 @@
+../../../../include/mini-os/list.h
\ No newline at end of file
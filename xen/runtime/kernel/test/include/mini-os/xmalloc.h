@@ -0,0 +1 @@
+../../../../include/mini-os/xmalloc.h
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+/* The summing kernels of the checksum stubs, to be included after them,
+   so that each one can be tested or timed in place of the one that
+   select_kernels picks */
+
+static const struct {
+  const char *name;
+  const char *cpu;
+  sum_block_fn sum;
+  copy_sum_block_fn copy;
+} kernels[] = {
+  { "scalar", NULL, sum_block_scalar, copy_sum_block_scalar },
+#if defined(__x86_64__)
+  { "sse2", "sse2", sum_block_sse2, copy_sum_block_sse2 },
+  { "avx2", "avx2", sum_block_avx2, copy_sum_block_avx2 },
+#endif
+};
+
+#define NR_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/* Whether this CPU can run kernel [k] */
+static int
+kernel_supported(unsigned int k)
+{
+  /* __builtin_cpu_supports wants a literal */
+  if (kernels[k].cpu == NULL)
+    return 1;
+  if (strcmp(kernels[k].cpu, "sse2") == 0)
+    return __builtin_cpu_supports("sse2");
+  if (strcmp(kernels[k].cpu, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  return 0;
+}
+
+/* Use kernel [k] from now on */
+static void
+kernel_select(unsigned int k)
+{
+  sum_block = kernels[k].sum;
+  copy_sum_block = kernels[k].copy;
+}
+
+#endif /* _KERNELS_H_ */
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Unit tests of the mm.c page allocator on a malloc'd arena */
+
+#include <hosted.h>
+#include "arena.h"
+
+#define ARENA_PAGES 8192
+/* Page 0 of the arena holds the allocation bitmap */
+#define FREE_PAGES  (ARENA_PAGES - 1)
+/* mm.c's PAGE_CACHE_SIZE */
+#define CACHE_PAGES 64
+#define ITERATIONS  100000
+#define LIVE        512
+
+static unsigned long
+pfn(unsigned long va)
+{
+    return virt_to_pfn(va);
+}
+
+/* Takes every free page, one at a time; returns how many there were */
+static unsigned long
+take_all(unsigned long *pages)
+{
+    unsigned long n = 0, va;
+
+    hosted_quiet = 1;
+    while ( (va = alloc_page()) != 0 )
+        pages[n++] = va;
+    hosted_quiet = 0;
+    return n;
+}
+
+/* Random allocations and frees: chunks are aligned on their size, lie
+   within the arena, never overlap and keep their contents. */
+static void
+test_random(void)
+{
+    static unsigned long owner[ARENA_PAGES];
+    struct { unsigned long va; int order; } live[LIVE];
+    unsigned long i, p;
+    int j, nr_live = 0;
+
+    hosted_arena_init(ARENA_PAGES);
+    memset(owner, 0, sizeof(owner));
+    srand(1);
+    for ( i = 1; i <= ITERATIONS; i++ )
+    {
+        if ( nr_live == LIVE || (nr_live != 0 && rand() % 2) )
+        {
+            j = rand() % nr_live;
+            for ( p = 0; p < 1UL << live[j].order; p++ )
+            {
+                unsigned long *page = (unsigned long *)
+                    (live[j].va + (p << PAGE_SHIFT));
+                assert(page[0] == live[j].va && owner[pfn(live[j].va) + p] != 0);
+                owner[pfn(live[j].va) + p] = 0;
+            }
+            free_pages((void *)live[j].va, live[j].order);
+            live[j] = live[--nr_live];
+        }
+        else
+        {
+            int order = rand() % 6;
+            unsigned long va = alloc_pages(order);
+
+            if ( va == 0 )
+                continue;
+            assert((to_phys(va) & ((PAGE_SIZE << order) - 1)) == 0);
+            assert(pfn(va) >= 1 && pfn(va) + (1UL << order) <= ARENA_PAGES);
+            for ( p = 0; p < 1UL << order; p++ )
+            {
+                assert(owner[pfn(va) + p] == 0);
+                owner[pfn(va) + p] = i;
+                *(unsigned long *)(va + (p << PAGE_SHIFT)) = va;
+            }
+            live[nr_live].va = va;
+            live[nr_live].order = order;
+            nr_live++;
+        }
+    }
+    while ( nr_live != 0 )
+    {
+        nr_live--;
+        free_pages((void *)live[nr_live].va, live[nr_live].order);
+    }
+    assert(total_free_pages() == FREE_PAGES);
+    sanity_check();
+}
+
+/* A superpage-sized chunk can be mapped by a single superpage */
+static void
+test_superpage(void)
+{
+    unsigned long va;
+    int i;
+
+    hosted_arena_init(ARENA_PAGES);
+    for ( i = 0; i < 8; i++ )
+    {
+        va = alloc_pages(SUPERPAGE_SHIFT);
+        assert(va != 0);
+        assert((to_phys(va) & ((PAGE_SIZE << SUPERPAGE_SHIFT) - 1)) == 0);
+    }
+}
+
+/* Pages parked in the order-0 cache are flushed to the buddy lists
+   before a request is declared impossible. */
+static void
+test_cache_flush(void)
+{
+    static unsigned long pages[ARENA_PAGES];
+    unsigned long n, base, i;
+
+    hosted_arena_init(ARENA_PAGES);
+    n = take_all(pages);
+    assert(n == FREE_PAGES);
+    assert(total_free_pages() == 0);
+
+    /* Free an aligned run of 64 pages: all of them go to the cache */
+    base = pfn(pages[0]) + CACHE_PAGES - 1;
+    base &= ~(unsigned long)(CACHE_PAGES - 1);
+    for ( i = 0; i < n; i++ )
+        if ( pfn(pages[i]) >= base && pfn(pages[i]) < base + CACHE_PAGES )
+        {
+            free_page((void *)pages[i]);
+            pages[i] = 0;
+        }
+    assert(total_free_pages() == CACHE_PAGES);
+    assert(free_chunks(0) == 0 && free_chunks(6) == 0);
+    assert(largest_free_order() == 0);
+    assert(fragmentation_index(6) == 1000);
+
+    /* Only a flush can coalesce them into the order-6 chunk asked for */
+    assert(alloc_pages(6) == (unsigned long)pfn_to_virt(base));
+    assert(total_free_pages() == 0);
+    free_pages(pfn_to_virt(base), 6);
+
+    /* When even a flush does not help, the request fails and the cache
+       pages are left in the buddy lists */
+    for ( i = 0; i < n; i++ )
+        if ( pages[i] != 0 && pfn(pages[i]) % 2 == 0 )
+        {
+            free_page((void *)pages[i]);
+            pages[i] = 0;
+        }
+    hosted_quiet = 1;
+    assert(alloc_pages(7) == 0);
+    hosted_quiet = 0;
+    assert(total_free_pages() == free_chunks(0) + (free_chunks(6) << 6));
+    assert(free_chunks(6) == 1);
+    sanity_check();
+}
+
+static void
+test_fragmentation_index(void)
+{
+    static unsigned long pages[ARENA_PAGES];
+    unsigned long n, i, freed = 0;
+    int order;
+
+    /* A fresh arena is split by alignment into one chunk of each order
+       below 13: only chunks of order k and up serve order k requests */
+    hosted_arena_init(ARENA_PAGES);
+    assert(fragmentation_index(0) == 0);
+    for ( order = 1; order <= 13; order++ )
+        assert(fragmentation_index(order) ==
+               ((1UL << order) - 1) * 1000 / FREE_PAGES);
+    assert(fragmentation_index(40) == 1000);
+
+    /* Every other page free, partly in the cache: nothing bigger than
+       one page can be had */
+    n = take_all(pages);
+    for ( i = 0; i < n; i++ )
+        if ( pfn(pages[i]) % 2 == 0 )
+        {
+            free_page((void *)pages[i]);
+            freed++;
+        }
+    assert(total_free_pages() == freed);
+    assert(fragmentation_index(0) == 0);
+    assert(fragmentation_index(1) == 1000);
+
+    /* No free memory at all */
+    hosted_arena_init(ARENA_PAGES);
+    take_all(pages);
+    assert(fragmentation_index(0) == 1000);
+    assert(fragmentation_index(1) == 1000);
+}
+
+int main() {
+    test_random();
+    printf("random allocations: ok\n");
+    test_superpage();
+    printf("superpage alignment: ok\n");
+    test_cache_flush();
+    printf("order-0 cache flush: ok\n");
+    test_fragmentation_index();
+    printf("fragmentation index: ok\n");
+    return 0;
+}
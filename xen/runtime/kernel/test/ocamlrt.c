@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* The rest of the OCaml runtime, for the GC and bigarray sources of
+   runtime/ocaml that the Makefile builds for Linux: there is no OCaml
+   code, so no stack or globals to scan, and no exception handler but
+   the one a test sets. What the tests never reach aborts. */
+
+#include <stdlib.h>
+#include <caml/mlvalues.h>
+#include <caml/gc.h>
+#include <caml/fail.h>
+#include <caml/intext.h>
+#include "ocamlrt.h"
+
+extern void caml_init_gc(uintnat, uintnat, uintnat, uintnat, uintnat);
+extern int caml_page_table_add(int kind, void *start, void *end);
+#define In_static_data 4
+
+/* startup.c */
+
+header_t caml_atom_table[256];
+
+void
+hosted_caml_init(void)
+{
+  int i;
+
+  caml_init_gc(Minor_heap_def, Init_heap_def, Heap_chunk_def,
+               Percent_free_def, Max_percent_free_def);
+  for (i = 0; i < 256; i++)
+    caml_atom_table[i] = Make_header(0, i, Caml_white);
+  if (caml_page_table_add(In_static_data, caml_atom_table, caml_atom_table + 256))
+    abort();
+}
+
+/* What ocamlopt emits for the program */
+
+intnat *caml_frametable[] = { NULL };
+value caml_globals[] = { 0 };
+
+/* fail.c */
+
+jmp_buf *hosted_caml_trap;
+
+static void Noreturn
+hosted_raise(void)
+{
+  if (hosted_caml_trap == NULL)
+    abort();
+  longjmp(*hosted_caml_trap, 1);
+}
+
+void caml_raise(value bucket) { hosted_raise(); }
+void caml_failwith(char const *msg) { hosted_raise(); }
+void caml_invalid_argument(char const *msg) { hosted_raise(); }
+void caml_raise_out_of_memory(void) { hosted_raise(); }
+void caml_raise_zero_divide(void) { hosted_raise(); }
+void caml_array_bound_error(void) { hosted_raise(); }
+void caml_sys_error(value arg) { hosted_raise(); }
+
+/* callback.c, compare.c, floats.c, str.c and signals_nat.c */
+
+int caml_compare_unordered;
+value caml_callback_exn(value closure, value arg) { abort(); }
+value caml_copy_double(double d) { abort(); }
+mlsize_t caml_string_length(value s) { abort(); }
+int caml_set_signal_action(int signo, int action) { abort(); }
+
+/* extern.c and intern.c: nothing is marshalled */
+
+void caml_serialize_int_1(int i) { abort(); }
+void caml_serialize_int_4(int32 i) { abort(); }
+void caml_serialize_int_8(int64 i) { abort(); }
+void caml_serialize_block_1(void *data, intnat len) { abort(); }
+void caml_serialize_block_2(void *data, intnat len) { abort(); }
+void caml_serialize_block_4(void *data, intnat len) { abort(); }
+void caml_serialize_block_8(void *data, intnat len) { abort(); }
+int caml_deserialize_uint_1(void) { abort(); }
+uint32 caml_deserialize_uint_4(void) { abort(); }
+int32 caml_deserialize_sint_4(void) { abort(); }
+int64 caml_deserialize_sint_8(void) { abort(); }
+void caml_deserialize_block_1(void *data, intnat len) { abort(); }
+void caml_deserialize_block_2(void *data, intnat len) { abort(); }
+void caml_deserialize_block_4(void *data, intnat len) { abort(); }
+void caml_deserialize_block_8(void *data, intnat len) { abort(); }
+void caml_deserialize_error(char *msg) { abort(); }
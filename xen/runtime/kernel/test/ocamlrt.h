@@ -0,0 +1,18 @@
+#ifndef _OCAMLRT_H_
+#define _OCAMLRT_H_
+
+#include <setjmp.h>
+#include <caml/mlvalues.h>
+
+/* Start the GC of runtime/ocaml, as startup.c does */
+void hosted_caml_init(void);
+
+/* Where OCaml exceptions raised from C land; they abort while NULL */
+extern jmp_buf *hosted_caml_trap;
+
+/* From the private headers of runtime/ocaml */
+extern double caml_extra_heap_resources;
+extern intnat caml_stat_major_collections, caml_stat_compactions;
+extern value caml_gc_full_major(value);
+
+#endif /* _OCAMLRT_H_ */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Io_page allocation stress: pages are allocated in a loop, a window of
+ * them is kept alive and the rest is dropped for the GC to finalise.
+ * page_stubs.c and mm.c are the real ones, and so is the OCaml runtime
+ * they run against: the 3.12 major and minor GCs, custom blocks and
+ * bigarrays of runtime/ocaml, built for Linux. ocamlrt.c stands in for
+ * the rest; exceptions longjmp back to io_page_get.
+ *
+ * Io_page.get falls back to a forced collection when caml_alloc_pages
+ * fails; that fallback was a Gc.compact. With the default budget it
+ * must never be reached, and the heap never compacted. With accounting
+ * made ineffective it must be, or the test would prove nothing.
+ * Beforehand, a failed bigarray header allocation must leave no page
+ * behind.
+ */
+
+#include <stdarg.h>
+
+/* Allocations of bigarray headers go through test_ba_alloc_dims */
+#define caml_ba_alloc_dims test_ba_alloc_dims
+#include "../page_stubs.c"
+#undef caml_ba_alloc_dims
+#include "arena.h"
+#include "ocamlrt.h"
+
+#define ARENA_PAGES 8192
+#define WINDOW      32
+#define ITERATIONS  200000
+#define LIVE_BLOCKS 512
+#define LIVE_WORDS  256
+
+static jmp_buf failure;
+
+/* Set to make the next header allocation raise, as out of memory */
+static int header_fails;
+
+value
+test_ba_alloc_dims(int flags, int num_dims, void *data, ...)
+{
+  intnat dim;
+  va_list ap;
+
+  if (header_fails) {
+    header_fails = 0;
+    caml_raise_out_of_memory();
+  }
+  assert(num_dims == 1);
+  va_start(ap, data);
+  dim = va_arg(ap, intnat);
+  va_end(ap);
+  return caml_ba_alloc(flags, 1, data, &dim);
+}
+
+/* The rest of a program's heap, a megabyte of live blocks. With next to
+   nothing live, the runtime's own rule of compacting once the estimated
+   overhead is Max_percent_free_def percent would be met at the end of
+   most major cycles, whatever started them. */
+static value live_data = Val_unit;
+
+static void
+fill_heap(void)
+{
+  int i;
+
+  caml_register_global_root(&live_data);
+  for (i = 0; i < LIVE_BLOCKS; i++) {
+    value b = caml_alloc_tuple(LIVE_WORDS);
+    Store_field(b, 0, live_data);
+    live_data = b;
+  }
+}
+
+/* Io_page.get */
+static unsigned long fallbacks;
+
+static value
+io_page_get(int n)
+{
+  struct caml__roots_block *roots = caml_local_roots;
+  volatile int tries = 0;
+
+  if (setjmp(failure) != 0) {
+    /* Unwound like caml_raise does */
+    caml_local_roots = roots;
+    if (tries++ > 0) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    fallbacks++;
+    caml_gc_full_major(Val_unit);
+  }
+  return caml_alloc_pages(Val_int(n));
+}
+
+static unsigned long
+run(unsigned int seed)
+{
+  static const int sizes[] = { 1, 1, 1, 1, 1, 1, 2, 4, 8, 16, 32 };
+  static value window;
+  int i;
+
+  hosted_arena_init(ARENA_PAGES);
+  fallbacks = 0;
+  window = caml_alloc_tuple(WINDOW);
+  caml_register_global_root(&window);
+  srand(seed);
+  for (i = 0; i < ITERATIONS; i++) {
+    int slot = rand() % WINDOW;
+    value v = io_page_get(sizes[rand() % (sizeof(sizes) / sizeof(sizes[0]))]);
+    memset(Caml_ba_data_val(v), i, PAGE_SIZE);
+    Store_field(window, slot, v);
+  }
+  caml_remove_global_root(&window);
+  caml_gc_full_major(Val_unit);
+  /* Every page is back in the pools or mm.c */
+  pool_drain();
+  assert(total_free_pages() == ARENA_PAGES - 1);
+  sanity_check();
+  return fallbacks;
+}
+
+/* A failure to allocate the bigarray header neither loses pages nor
+   charges them to the GC */
+static void
+header_failure(void)
+{
+  unsigned long free_before;
+  double charged;
+
+  hosted_arena_init(ARENA_PAGES);
+  pool_drain();
+  free_before = total_free_pages();
+  charged = caml_extra_heap_resources;
+  header_fails = 1;
+  if (setjmp(failure) == 0) {
+    caml_alloc_pages(Val_int(4));
+    abort();
+  }
+  caml_local_roots = NULL;
+  pool_drain();
+  assert(total_free_pages() == free_before);
+  assert(caml_extra_heap_resources == charged);
+  printf("header allocation failure: ok\n");
+}
+
+int main() {
+  unsigned long n, collections;
+
+  hosted_caml_init();
+  hosted_caml_trap = &failure;
+  fill_heap();
+  header_failure();
+
+  /* The default budget, a quarter of the arena */
+  collections = caml_stat_major_collections;
+  n = run(1);
+  printf("default budget: %lu major collections, %lu fallbacks\n",
+         (unsigned long)caml_stat_major_collections - collections, n);
+  assert(n == 0);
+  assert(caml_stat_compactions == 0);
+
+  /* A budget the domain could never reach: the GC is not told */
+  caml_io_page_set_gc_budget(Val_long(1L << 30));
+  hosted_quiet = 1;
+  collections = caml_stat_major_collections;
+  n = run(1);
+  hosted_quiet = 0;
+  printf("no accounting:  %lu major collections, %lu fallbacks\n",
+         (unsigned long)caml_stat_major_collections - collections, n);
+  assert(n > 0);
+
+  return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* The page allocator interface of mm.c over the C library, for the
+   xmalloc builds: chunks keep mm.c's alignment on their size, and the
+   pages handed out are counted so that leaks show. */
+
+#include <hosted.h>
+#include "pages.h"
+
+int hosted_quiet;
+unsigned long hosted_pages;
+
+unsigned long
+alloc_pages(int order)
+{
+    void *p = aligned_alloc(PAGE_SIZE << order, PAGE_SIZE << order);
+
+    if (p != NULL)
+        hosted_pages += 1UL << order;
+    return (unsigned long)p;
+}
+
+void
+free_pages(void *pointer, int order)
+{
+    assert(((unsigned long)pointer & ((PAGE_SIZE << order) - 1)) == 0);
+    hosted_pages -= 1UL << order;
+    free(pointer);
+}
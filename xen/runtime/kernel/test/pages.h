@@ -0,0 +1,15 @@
+#ifndef _PAGES_H_
+#define _PAGES_H_
+
+/* Pages currently handed out by the shim page allocator */
+extern unsigned long hosted_pages;
+
+/* xmalloc.c, built with its entry points renamed so that they do not
+   replace those of the C library */
+void *xm_malloc(size_t size);
+void *xm_memalign(size_t align, size_t size);
+void *xm_realloc(void *ptr, size_t size);
+void *xm_calloc(size_t nmemb, size_t size);
+void xm_free(void *p);
+
+#endif /* _PAGES_H_ */
@@ -0,0 +1,9 @@
+#!/bin/sh
+
+TESTPROGRAMS="page_stress mm_test xmalloc_fuzz checksum_test checksum_test_unix\
+	checksum_test_ns3 checksum_test_kfreebsd bigstring_test eventchn_test"
+
+for p in $TESTPROGRAMS; do
+echo "---";echo testing $p;echo "---"
+ ./$p || { echo TESTCASE $p exited non-zero 1>&2 ; exit 1; }
+ done
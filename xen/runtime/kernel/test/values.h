@@ -0,0 +1,97 @@
+#ifndef _VALUES_H_
+#define _VALUES_H_
+
+/* Just enough of the OCaml heap to call stubs from C: blocks are
+   carved out of a static heap, never moved, and all dropped at once by
+   values_reset. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/bigarray.h>
+#include <caml/gc.h>
+
+struct caml__roots_block *caml_local_roots;
+
+/* Where caml_invalid_argument returns to, like a try ... with */
+static jmp_buf invalid_argument;
+
+void
+caml_invalid_argument(char const *msg)
+{
+  longjmp(invalid_argument, 1);
+}
+
+#define HEAP_WORDS 65536
+
+static value heap[HEAP_WORDS];
+static mlsize_t heap_used;
+
+static void
+values_reset(void)
+{
+  heap_used = 0;
+}
+
+static value
+alloc_block(mlsize_t wosize, tag_t tag)
+{
+  value *b = heap + heap_used;
+
+  assert(heap_used + wosize + 1 <= HEAP_WORDS);
+  heap_used += wosize + 1;
+  memset(b, 0, (wosize + 1) * sizeof(value));
+  b[0] = Make_header(wosize, tag, 0);
+  return (value)(b + 1);
+}
+
+/* A one-dimensional char bigarray over [data] */
+static value
+bigarray(void *data, intnat len)
+{
+  value v = alloc_block(1 + (sizeof(struct caml_ba_array) + sizeof(value) - 1) / sizeof(value),
+                        Custom_tag);
+  struct caml_ba_array *ba = Caml_ba_array_val(v);
+
+  ba->data = data;
+  ba->num_dims = 1;
+  ba->flags = CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_EXTERNAL;
+  ba->dim[0] = len;
+  return v;
+}
+
+/* A Cstruct.t { buffer; off; len } */
+static value
+cstruct(value buffer, intnat off, intnat len)
+{
+  value v = alloc_block(3, 0);
+
+  Field(v, 0) = buffer;
+  Field(v, 1) = Val_long(off);
+  Field(v, 2) = Val_long(len);
+  return v;
+}
+
+static value
+cons(value hd, value tl)
+{
+  value v = alloc_block(2, 0);
+
+  Field(v, 0) = hd;
+  Field(v, 1) = tl;
+  return v;
+}
+
+static value
+boxed_int32(int32 i)
+{
+  value v = alloc_block(2, Custom_tag);
+
+  Int32_val(v) = i;
+  return v;
+}
+
+#endif /* _VALUES_H_ */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * malloc/free timings of xmalloc.c next to those of the C library, for
+ * the allocation patterns of the runtime: short-lived small objects,
+ * a working set of mixed sizes, and page-sized buffers. The xmalloc.c
+ * built is chosen with XMALLOC=, so that two versions can be compared:
+ * make clean bench XMALLOC=/path/to/old/xmalloc.c
+ */
+
+#include <time.h>
+#include <hosted.h>
+#include "pages.h"
+
+#define OPS    4000000
+#define WINDOW 4096
+
+struct allocator {
+    const char *name;
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+};
+
+static const struct allocator allocators[] = {
+    { "xmalloc", xm_malloc, xm_free },
+    { "libc", malloc, free },
+};
+
+static void *window[WINDOW];
+static size_t mixed[WINDOW];
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Allocate and free at once, as for a temporary */
+static void
+pairs(const struct allocator *a, size_t size)
+{
+    long i;
+
+    for (i = 0; i < OPS; i++) {
+        void *p = a->malloc(size);
+        *(volatile char *)p = 0;
+        a->free(p);
+    }
+}
+
+/* Replace objects at random in a window of live ones */
+static void
+churn(const struct allocator *a, const size_t *sizes)
+{
+    long i;
+    int j;
+
+    for (j = 0; j < WINDOW; j++)
+        window[j] = a->malloc(sizes[j]);
+    for (i = 0; i < OPS; i++) {
+        j = (i * 2654435761UL) % WINDOW;
+        a->free(window[j]);
+        window[j] = a->malloc(sizes[(j + i) % WINDOW]);
+        *(volatile char *)window[j] = 0;
+    }
+    for (j = 0; j < WINDOW; j++)
+        a->free(window[j]);
+}
+
+static size_t fixed64[WINDOW], page[WINDOW];
+
+static void run_pairs64(const struct allocator *a) { pairs(a, 64); }
+static void run_pairs_page(const struct allocator *a) { pairs(a, PAGE_SIZE); }
+static void run_churn64(const struct allocator *a) { churn(a, fixed64); }
+static void run_churn_mixed(const struct allocator *a) { churn(a, mixed); }
+static void run_churn_page(const struct allocator *a) { churn(a, page); }
+
+static const struct {
+    const char *name;
+    void (*run)(const struct allocator *);
+} workloads[] = {
+    { "pairs, 64 bytes", run_pairs64 },
+    { "pairs, 4096 bytes", run_pairs_page },
+    { "window, 64 bytes", run_churn64 },
+    { "window, 16-2048 bytes", run_churn_mixed },
+    { "window, 4096 bytes", run_churn_page },
+};
+
+int main() {
+    unsigned int w, a;
+    int j;
+
+    srand(1);
+    for (j = 0; j < WINDOW; j++) {
+        fixed64[j] = 64;
+        page[j] = PAGE_SIZE;
+        mixed[j] = 16 + rand() % 2033;
+    }
+    printf("%-24s", "ns per malloc+free");
+    for (a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++)
+        printf("%10s", allocators[a].name);
+    printf("\n");
+    for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        printf("%-24s", workloads[w].name);
+        for (a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+            double start = now();
+            workloads[w].run(&allocators[a]);
+            printf("%10.1f", (now() - start) / OPS);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2011 Anil Madhavapeddy <anil@recoil.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Random malloc, memalign, calloc, realloc and free calls on xmalloc.c.
+ * Every object is filled with a pattern of its own, checked when it is
+ * reallocated or freed, so overlapping objects and lost contents show;
+ * alignment is checked on return. When everything is freed again the
+ * statistics must be back to zero and only the spare slabs may remain.
+ * Build with CC="gcc -fsanitize=address,undefined" to also catch
+ * accesses outside the pages the shim handed out.
+ */
+
+#include <hosted.h>
+#include <mini-os/xmalloc.h>
+#include "pages.h"
+
+#define SLOTS      20000
+#define ITERATIONS 2000000
+/* xmalloc.c's NR_CLASSES */
+#define NR_CLASSES 16
+
+static unsigned char *ptrs[SLOTS];
+static size_t sizes[SLOTS];
+
+static void
+fill(int i)
+{
+    size_t k;
+
+    for (k = 0; k < sizes[i]; k++)
+        ptrs[i][k] = (unsigned char)(i + k);
+}
+
+static void
+check(int i)
+{
+    size_t k;
+
+    for (k = 0; k < sizes[i]; k++)
+        if (ptrs[i][k] != (unsigned char)(i + k)) {
+            fprintf(stderr, "object %d (%zu bytes at %p) corrupt at %zu\n",
+                    i, sizes[i], ptrs[i], k);
+            exit(1);
+        }
+}
+
+static size_t
+random_size(void)
+{
+    switch (rand() % 8) {
+    case 0:  return rand() % 64;
+    case 1:  return 2000 + rand() % 32;     /* around MAX_SMALL */
+    case 2:  return rand() % 20000;         /* large */
+    default: return rand() % 2100;
+    }
+}
+
+static void
+allocate(int i)
+{
+    size_t align = sizeof(unsigned long);
+    unsigned char *p;
+    size_t k;
+
+    sizes[i] = random_size();
+    switch (rand() % 10) {
+    case 0:
+        align = 1UL << (rand() % 14);
+        p = xm_memalign(align, sizes[i]);
+        break;
+    case 1:
+        p = xm_calloc(1, sizes[i]);
+        for (k = 0; k < sizes[i]; k++)
+            assert(p == NULL || p[k] == 0);
+        if (sizes[i] == 0) {
+            /* calloc(1, 0) is NULL */
+            assert(p == NULL);
+            return;
+        }
+        break;
+    default:
+        p = xm_malloc(sizes[i]);
+    }
+    assert(p != NULL);
+    if (align < sizeof(unsigned long))
+        align = sizeof(unsigned long);
+    if ((unsigned long)p % align != 0) {
+        fprintf(stderr, "%p is not aligned on %zu\n", p, align);
+        exit(1);
+    }
+    ptrs[i] = p;
+    fill(i);
+}
+
+static void
+reallocate(int i)
+{
+    size_t old = sizes[i], size = random_size();
+
+    check(i);
+    ptrs[i] = xm_realloc(ptrs[i], size);
+    assert(ptrs[i] != NULL);
+    /* What was there is still there */
+    sizes[i] = old < size ? old : size;
+    check(i);
+    sizes[i] = size;
+    fill(i);
+}
+
+int main() {
+    struct xmalloc_stats st;
+    unsigned long ops = 0;
+    int i, n;
+
+    srand(1);
+    for (n = 0; n < ITERATIONS; n++) {
+        i = rand() % SLOTS;
+        if (ptrs[i] == NULL)
+            allocate(i);
+        else if (rand() % 5 == 0)
+            reallocate(i);
+        else {
+            check(i);
+            xm_free(ptrs[i]);
+            ptrs[i] = NULL;
+        }
+        ops++;
+    }
+    for (i = 0; i < SLOTS; i++)
+        if (ptrs[i] != NULL) {
+            check(i);
+            xm_free(ptrs[i]);
+        }
+
+    xmalloc_get_stats(&st);
+    printf("%lu calls: %lu mallocs, %lu frees, %lu slab pages left\n",
+           ops, st.mallocs, st.frees, st.slab_pages);
+    assert(st.mallocs == st.frees);
+    assert(st.small_bytes == 0 && st.large_bytes == 0 && st.large_pages == 0);
+    assert(st.slab_pages <= NR_CLASSES);
+    assert(hosted_pages == st.slab_pages);
+    return 0;
+}
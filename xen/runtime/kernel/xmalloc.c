@@ -14,13 +14,15 @@
  *              Nov 2010
  * 
  * Environment: Xen Minimal OS
- * Description: simple memory allocator
+ * Description: size-class memory allocator
  *
  ****************************************************************************
- * Simple allocator for Mini-os.  If larger than a page, simply use the
- * page-order allocator.
+ * Small objects are carved out of single-page slabs, one list of slabs
+ * per size class, so malloc and free are O(1) and need no per-object
+ * header. Anything larger than the biggest class, or needing more than
+ * 16-byte alignment, comes straight from the page-order allocator.
  *
- * Copy of the allocator for Xen by Rusty Russell:
+ * Originally based on the allocator for Xen by Rusty Russell:
  * Copyright (C) 2005 Rusty Russell IBM Corporation
  *
  * This program is free software; you can redistribute it and/or modify
@@ -42,26 +44,55 @@
 #include <mm.h>
 #include <mini-os/types.h>
 #include <mini-os/lib.h>
-#include <mini-os/list.h>
 #include <mini-os/xmalloc.h>
 
-static MINIOS_LIST_HEAD(freelist);
-/* static spinlock_t freelist_lock = SPIN_LOCK_UNLOCKED; */
+/*
+ * Every allocation has a header at the start of the page holding the
+ * byte just before it, i.e. at ((p - 1) & PAGE_MASK):
+ *  - a slab object never starts at the beginning of its page, since the
+ *    slab header comes first;
+ *  - a large allocation starts within the first page of its chunk,
+ *    where the header is, unless it is page-aligned, in which case a
+ *    copy of the header goes in the page just before it.
+ */
+#define XMALLOC_MAGIC_SLAB  0x51ab51abU
+#define XMALLOC_MAGIC_LARGE 0x1a26e1a2U
 
-struct xmalloc_hdr
-{
-    /* Total including this hdr, unused padding and second hdr. */
-    size_t size;
-    struct minios_list_head freelist;
-} __cacheline_aligned;
+#define SMALL_ALIGN 16
+
+struct slab {
+    unsigned int magic;
+    unsigned short cls;
+    unsigned short nr_free;
+    void *free;               /* free objects, linked through their first word */
+    struct slab *next, *prev; /* slabs of this class with free objects */
+};
 
-/* Unused padding data between the two hdrs. */
+struct large {
+    unsigned int magic;
+    unsigned int order;
+    void *chunk;
+    size_t size;              /* bytes requested */
+};
 
-struct xmalloc_pad
-{
-    /* Size including both hdrs. */
-    size_t hdr_size;
+#define SLAB_DATA align_up(sizeof(struct slab), SMALL_ALIGN)
+
+static const unsigned short class_size[] = {
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 672, 1008, 2016
 };
+#define NR_CLASSES (sizeof(class_size) / sizeof(class_size[0]))
+#define MAX_SMALL 2016
+
+/* Smallest class for each 16-byte step up to MAX_SMALL */
+static unsigned char size_to_class[MAX_SMALL / SMALL_ALIGN + 1];
+static int classes_ready;
+
+static struct slab *partial[NR_CLASSES];
+/* Empty slabs are kept, one per class, to avoid thrashing the page
+   allocator when an object comes and goes */
+static struct slab *spare[NR_CLASSES];
+
+static struct xmalloc_stats stats;
 
 /* Return size, increased to alignment with align. */
 static inline size_t align_up(size_t size, size_t align)
@@ -69,134 +100,173 @@ static inline size_t align_up(size_t size, size_t align)
     return (size + align - 1) & ~(align - 1);
 }
 
-static void maybe_split(struct xmalloc_hdr *hdr, size_t size, size_t block)
+static void init_classes(void)
 {
-    struct xmalloc_hdr *extra;
-    size_t leftover;
-    size = align_up(size, __alignof__(struct xmalloc_hdr));
-    size = align_up(size, __alignof__(struct xmalloc_pad));
-    leftover = block - size;
-
-    /* If enough is left to make a block, put it on free list. */
-    if ( leftover >= (2 * (sizeof(struct xmalloc_hdr) + sizeof(struct xmalloc_pad))) )
-    {
-        extra = (struct xmalloc_hdr *)((unsigned long)hdr + size);
-        extra->size = leftover;
-        /* spin_lock_irqsave(&freelist_lock, flags); */
-        minios_list_add(&extra->freelist, &freelist);
-        /* spin_unlock_irqrestore(&freelist_lock, flags); */
-    }
-    else
+    unsigned int i, c = 0;
+
+    for ( i = 0; i <= MAX_SMALL / SMALL_ALIGN; i++ )
     {
-        size = block;
+        while ( class_size[c] < i * SMALL_ALIGN )
+            c++;
+        size_to_class[i] = c;
     }
-
-    hdr->size = size;
-    /* Debugging aid. */
-    hdr->freelist.next = hdr->freelist.prev = NULL;
+    classes_ready = 1;
 }
 
-static struct xmalloc_hdr *xmalloc_new_page(size_t size)
+static inline unsigned int slab_capacity(unsigned int cls)
 {
-    struct xmalloc_hdr *hdr;
-    /* unsigned long flags; */
-
-    hdr = (struct xmalloc_hdr *)alloc_page();
-    if ( hdr == NULL )
-        return NULL;
+    return (PAGE_SIZE - SLAB_DATA) / class_size[cls];
+}
 
-    maybe_split(hdr, size, PAGE_SIZE);
+static void slab_link(struct slab *s)
+{
+    s->prev = NULL;
+    s->next = partial[s->cls];
+    if ( s->next != NULL )
+        s->next->prev = s;
+    partial[s->cls] = s;
+}
 
-    return hdr;
+static void slab_unlink(struct slab *s)
+{
+    if ( s->prev != NULL )
+        s->prev->next = s->next;
+    else
+        partial[s->cls] = s->next;
+    if ( s->next != NULL )
+        s->next->prev = s->prev;
 }
 
-/* Big object?  Just use the page allocator. */
-static void *xmalloc_whole_pages(size_t size, size_t align)
+static struct slab *slab_new(unsigned int cls)
 {
-    struct xmalloc_hdr *hdr;
-    struct xmalloc_pad *pad;
-    unsigned int pageorder;
-    void *ret;
-    /* Room for headers */
-    size_t hdr_size = sizeof(struct xmalloc_hdr) + sizeof(struct xmalloc_pad);
-    /* Align for actual beginning of data */
-    hdr_size = align_up(hdr_size, align);
+    struct slab *s;
+    char *obj;
+    unsigned int i, n = slab_capacity(cls);
 
-    pageorder = get_order(hdr_size + size);
+    if ( spare[cls] != NULL )
+    {
+        s = spare[cls];
+        spare[cls] = NULL;
+        return s;
+    }
 
-    hdr = (struct xmalloc_hdr *)alloc_pages(pageorder);
-    if ( hdr == NULL )
+    s = (struct slab *)alloc_page();
+    if ( s == NULL )
         return NULL;
+    stats.slab_pages++;
+    s->magic = XMALLOC_MAGIC_SLAB;
+    s->cls = cls;
+    s->nr_free = n;
+    obj = (char *)s + SLAB_DATA;
+    s->free = obj;
+    for ( i = 0; i + 1 < n; i++, obj += class_size[cls] )
+        *(void **)obj = obj + class_size[cls];
+    *(void **)obj = NULL;
+    return s;
+}
 
-    hdr->size = (1UL << (pageorder + PAGE_SHIFT));
-    /* Debugging aid. */
-    hdr->freelist.next = hdr->freelist.prev = NULL;
+static void *small_alloc(size_t size)
+{
+    unsigned int cls = size_to_class[align_up(size, SMALL_ALIGN) / SMALL_ALIGN];
+    struct slab *s = partial[cls];
+    void *obj;
 
-    ret = (char*)hdr + hdr_size;
-    pad = (struct xmalloc_pad *) ret - 1;
-    pad->hdr_size = hdr_size;
-    return ret;
+    if ( s == NULL )
+    {
+        s = slab_new(cls);
+        if ( s == NULL )
+            return NULL;
+        slab_link(s);
+    }
+    obj = s->free;
+    s->free = *(void **)obj;
+    if ( --s->nr_free == 0 )
+        slab_unlink(s);
+    stats.small_bytes += class_size[cls];
+    return obj;
 }
 
-void *_xmalloc(size_t size, size_t align)
+static void small_free(struct slab *s, void *p)
 {
-    struct xmalloc_hdr *i, *tmp, *hdr = NULL;
-    uintptr_t data_begin;
-    size_t hdr_size;
-    /* unsigned long flags; */
-
-    hdr_size = sizeof(struct xmalloc_hdr) + sizeof(struct xmalloc_pad);
-    /* Align on headers requirements. */
-    align = align_up(align, __alignof__(struct xmalloc_hdr));
-    align = align_up(align, __alignof__(struct xmalloc_pad));
-
-    /* For big allocs, give them whole pages. */
-    if ( size + align_up(hdr_size, align) >= PAGE_SIZE )
-        return xmalloc_whole_pages(size, align);
-
-    /* Search free list. */
-    /* spin_lock_irqsave(&freelist_lock, flags); */
-    minios_list_for_each_entry_safe( i, tmp, &freelist, freelist )
-    {
-        data_begin = align_up((uintptr_t)i + hdr_size, align);
+    unsigned int cls = s->cls;
 
-        if ( data_begin + size > (uintptr_t)i + i->size )
-            continue;
+    if ( ((char *)p - ((char *)s + SLAB_DATA)) % class_size[cls] != 0 )
+    {
+        printk("free(%p): not an object of its slab\n", p);
+        BUG();
+    }
+    *(void **)p = s->free;
+    s->free = p;
+    stats.small_bytes -= class_size[cls];
+    if ( s->nr_free++ == 0 )
+        slab_link(s);
+    if ( s->nr_free == slab_capacity(cls) )
+    {
+        slab_unlink(s);
+        if ( spare[cls] == NULL )
+            spare[cls] = s;
+        else
+        {
+            s->magic = 0;
+            free_page(s);
+            stats.slab_pages--;
+        }
+    }
+}
 
-        minios_list_del(&i->freelist);
-        /* spin_unlock_irqrestore(&freelist_lock, flags); */
+static void *large_alloc(size_t size, size_t align)
+{
+    size_t offset = align_up(sizeof(struct large), align);
+    unsigned int order = get_order(offset + size);
+    struct large *hdr;
+    char *ret;
 
-        uintptr_t size_before = (data_begin - hdr_size) - (uintptr_t)i;
+    hdr = (struct large *)alloc_pages(order);
+    if ( hdr == NULL )
+        return NULL;
+    hdr->magic = XMALLOC_MAGIC_LARGE;
+    hdr->order = order;
+    hdr->chunk = hdr;
+    hdr->size = size;
+    ret = (char *)hdr + offset;
+    if ( offset >= PAGE_SIZE )
+        /* Page-aligned: the header belongs in the page before */
+        *(struct large *)(ret - PAGE_SIZE) = *hdr;
+    stats.large_pages += 1UL << order;
+    stats.large_bytes += size;
+    return ret;
+}
 
-        if (size_before >= 2 * hdr_size) {
-            /* Worth splitting the beginning */
-            struct xmalloc_hdr *new_i = (void*)(data_begin - hdr_size);
-            new_i->size = i->size - size_before;
-            i->size = size_before;
-            /* spin_lock_irqsave(&freelist_lock, flags); */
-            minios_list_add(&i->freelist, &freelist);
-            /* spin_unlock_irqrestore(&freelist_lock, flags); */
-            i = new_i;
-        }
-        maybe_split(i, (data_begin + size) - (uintptr_t)i, i->size);
-        hdr = i;
-        break;
-    }
+static void large_free(struct large *hdr)
+{
+    unsigned int order = hdr->order;
+    void *chunk = hdr->chunk;
+
+    stats.large_pages -= 1UL << order;
+    stats.large_bytes -= hdr->size;
+    hdr->magic = 0;
+    ((struct large *)chunk)->magic = 0;
+    free_pages(chunk, order);
+}
 
-    if (!hdr) {
-        /* spin_unlock_irqrestore(&freelist_lock, flags); */
+void *_xmalloc(size_t size, size_t align)
+{
+    void *ret;
 
-        /* Alloc a new page and return from that. */
-        hdr = xmalloc_new_page(align_up(hdr_size, align) + size);
-        if ( hdr == NULL )
-            return NULL;
-        data_begin = (uintptr_t)hdr + align_up(hdr_size, align);
-    }
+    if ( !classes_ready )
+        init_classes();
+    if ( align < DEFAULT_ALIGN )
+        align = DEFAULT_ALIGN;
+    if ( size == 0 )
+        size = 1;
 
-    struct xmalloc_pad *pad = (struct xmalloc_pad *) data_begin - 1;
-    pad->hdr_size = data_begin - (uintptr_t)hdr;
-    BUG_ON(data_begin % align);
-    return (void*)data_begin;
+    if ( size <= MAX_SMALL && align <= SMALL_ALIGN )
+        ret = small_alloc(size);
+    else
+        ret = large_alloc(size, align);
+    if ( ret != NULL )
+        stats.mallocs++;
+    return ret;
 }
 
 void *malloc(size_t size)
@@ -204,109 +274,66 @@ void *malloc(size_t size)
     return _xmalloc(size, DEFAULT_ALIGN);
 }
 
+/* The header describing the allocation at p, see above. */
+static inline void *header_of(void *p)
+{
+    return (void *)(((unsigned long)p - 1) & PAGE_MASK);
+}
+
 void free(void *p)
 {
-    /* unsigned long flags; */
-    struct xmalloc_hdr *i, *tmp, *hdr;
-    struct xmalloc_pad *pad;
+    void *hdr;
 
     if ( p == NULL )
         return;
 
-    pad = (struct xmalloc_pad *)p - 1;
-    hdr = (struct xmalloc_hdr *)((char *)p - pad->hdr_size);
-
-    /* Big allocs free directly. */
-    if ( hdr->size >= PAGE_SIZE )
-    {
-        free_pages(hdr, get_order(hdr->size));
-        return;
-    }
-
-    /* We know hdr will be on same page. */
-    if(((long)p & PAGE_MASK) != ((long)hdr & PAGE_MASK))
-    {
-        printk("Header should be on the same page\n");
-        *(int*)0=0;
-    }
-
-    /* Not previously freed. */
-    if(hdr->freelist.next || hdr->freelist.prev)
+    hdr = header_of(p);
+    switch ( *(unsigned int *)hdr )
     {
-        printk("Should not be previously freed\n");
-        *(int*)0=0;
+    case XMALLOC_MAGIC_SLAB:
+        small_free(hdr, p);
+        break;
+    case XMALLOC_MAGIC_LARGE:
+        large_free(hdr);
+        break;
+    default:
+        printk("free(%p): not allocated, or freed twice\n", p);
+        BUG();
     }
+    stats.frees++;
+}
 
-    /* Merge with other free block, or put in list. */
-    /* spin_lock_irqsave(&freelist_lock, flags); */
-    minios_list_for_each_entry_safe( i, tmp, &freelist, freelist )
-    {
-        unsigned long _i   = (unsigned long)i;
-        unsigned long _hdr = (unsigned long)hdr;
-
-        /* Do not merge across page boundaries. */
-        if ( ((_i ^ _hdr) & PAGE_MASK) != 0 )
-            continue;
-
-        /* We follow this block?  Swallow it. */
-        if ( (_i + i->size) == _hdr )
-        {
-            minios_list_del(&i->freelist);
-            i->size += hdr->size;
-            hdr = i;
-        }
-
-        /* We precede this block? Swallow it. */
-        if ( (_hdr + hdr->size) == _i )
-        {
-            minios_list_del(&i->freelist);
-            hdr->size += i->size;
-        }
-    }
+/* Bytes usable at p */
+static size_t usable_size(void *p)
+{
+    void *hdr = header_of(p);
 
-    /* Did we merge an entire page? */
-    if ( hdr->size == PAGE_SIZE )
-    {
-        if((((unsigned long)hdr) & (PAGE_SIZE-1)) != 0)
-        {
-            printk("Bug\n");
-            *(int*)0=0;
-        }
-        free_page(hdr);
-    }
+    if ( *(unsigned int *)hdr == XMALLOC_MAGIC_SLAB )
+        return class_size[((struct slab *)hdr)->cls];
     else
     {
-        minios_list_add(&hdr->freelist, &freelist);
+        struct large *l = hdr;
+        return (char *)l->chunk + (PAGE_SIZE << l->order) - (char *)p;
     }
-
-    /* spin_unlock_irqrestore(&freelist_lock, flags); */
 }
 
 void *realloc(void *ptr, size_t size)
 {
     void *new;
-    struct xmalloc_hdr *hdr;
-    struct xmalloc_pad *pad;
-    size_t old_data_size;
+    size_t old_size;
 
     if (ptr == NULL)
         return _xmalloc(size, DEFAULT_ALIGN);
 
-    pad = (struct xmalloc_pad *)ptr - 1;
-    hdr = (struct xmalloc_hdr *)((char*)ptr - pad->hdr_size);
-
-    old_data_size = hdr->size - pad->hdr_size;
-    if ( old_data_size >= size )
-    {
-	maybe_split(hdr, pad->hdr_size + size, hdr->size);
+    old_size = usable_size(ptr);
+    if ( old_size >= size )
         return ptr;
-    }
     
     new = _xmalloc(size, DEFAULT_ALIGN);
     if (new == NULL) 
         return NULL;
 
-    memcpy(new, ptr, old_data_size);
+    memcpy(new, ptr, old_size);
     free(ptr);
 
     return new;
@@ -316,10 +343,15 @@ void *calloc(size_t nmemb, size_t size)
 {
     size_t tsize = nmemb * size;
     void *p;
-    if (!tsize)
+    if (!tsize || tsize / nmemb != size)
       return NULL;
     p = malloc(tsize);
-    memset(p,0,tsize);
+    if (p != NULL)
+      memset(p,0,tsize);
     return p;
 }
 
+void xmalloc_get_stats(struct xmalloc_stats *s)
+{
+    *s = stats;
+}
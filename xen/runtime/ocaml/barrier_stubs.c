@@ -15,6 +15,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <caml/mlvalues.h>
@@ -41,28 +42,29 @@ caml_write_memory_barrier()
   return Val_unit;
 }
 
-CAMLprim value caml_cstruct_unsafe_load_uint32(value vc, value vofs) {
-  CAMLparam2(vc, vofs);
-  CAMLlocal2(vb, vbofs);
-  vb = Field(vc, 0);
-  vbofs = Field(vc, 1);
-  int ofs = Int_val(vofs);
-  int bofs = Int_val(vbofs);
-  struct caml_ba_array *b = Caml_ba_array_val(vb);
-  uint32_t *data = ((uint32_t*) (b->data + bofs));
-  CAMLreturn (Val_int(data[ofs / sizeof(uint32_t)]));
+/* Native-order 32-bit accesses at byte [ofs] of a Cstruct.t, rounded
+ * down to a multiple of 4 as the callers index 32-bit words. Neither
+ * allocates, so they register no roots and are declared "noalloc". */
+
+static inline uint8_t *
+cstruct_word(value vc, value vofs)
+{
+  uint8_t *data = Caml_ba_data_val(Field(vc, 0));
+  return data + Long_val(Field(vc, 1)) + (Long_val(vofs) & ~(intnat)3);
 }
 
-CAMLprim value caml_cstruct_unsafe_save_uint32(value vc, value vofs, value x) {
-  CAMLparam3(vc, vofs, x);
-  CAMLlocal2(vb, vbofs);
-  vb = Field(vc, 0);
-  vbofs = Field(vc, 1);
-  int ofs = Int_val(vofs);
-  int bofs = Int_val(vbofs);
-  struct caml_ba_array *b = Caml_ba_array_val(vb);
-  uint32_t *data = ((uint32_t*) (b->data + bofs));
-  data[ofs / sizeof(uint32_t)] = Int_val(x);
-  CAMLreturn (Val_unit);
+CAMLprim value
+caml_cstruct_unsafe_load_uint32(value vc, value vofs)
+{
+  uint32_t v;
+  memcpy(&v, cstruct_word(vc, vofs), sizeof(v));
+  return Val_long(v);
 }
 
+CAMLprim value
+caml_cstruct_unsafe_save_uint32(value vc, value vofs, value x)
+{
+  uint32_t v = Long_val(x);
+  memcpy(cstruct_word(vc, vofs), &v, sizeof(v));
+  return Val_unit;
+}
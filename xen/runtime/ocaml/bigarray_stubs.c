@@ -24,6 +24,8 @@
 #include "memory.h"
 #include "mlvalues.h"
 
+extern void caml_ba_unmap_file(void * addr, uintnat len);
+
 #define int8 caml_ba_int8
 #define uint8 caml_ba_uint8
 #define int16 caml_ba_int16
@@ -507,7 +509,19 @@ static void caml_ba_finalize(value v)
     }
     break;
   case CAML_BA_MAPPED_FILE:
-    caml_failwith("CAML_BA_MAPPED_FILE: unsupported");
+    /* Io_page arrays: caml_alloc_pages in kernel/page_stubs.c flags its
+       blocks this way, and its caml_ba_unmap_file gives them back to
+       the page pool, working out their order from the length. It needs
+       the start of the block and its full size, taken from the proxy
+       for sub-arrays (see caml_ba_update_proxy), or pages leak. */
+    if (b->proxy == NULL) {
+      caml_ba_unmap_file(b->data, caml_ba_byte_size(b));
+    } else {
+      if (-- b->proxy->refcount == 0) {
+        caml_ba_unmap_file(b->proxy->data, b->proxy->size);
+        caml_stat_free(b->proxy);
+      }
+    }
     break;
   }
 }
@@ -830,6 +844,8 @@ static void caml_ba_update_proxy(struct caml_ba_array * b1,
     proxy = caml_stat_alloc(sizeof(struct caml_ba_proxy));
     proxy->refcount = 2;      /* original array + sub array */
     proxy->data = b1->data;
+    /* The size of the whole mapping, which caml_ba_finalize passes to
+       caml_ba_unmap_file, i.e. that of an Io_page block */
     proxy->size =
       b1->flags & CAML_BA_MAPPED_FILE ? caml_ba_byte_size(b1) : 0;
     b1->proxy = proxy;
@@ -17,6 +17,7 @@
 
 #include <sys/param.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
 
@@ -51,3 +52,128 @@ caml_blit_bigstring_to_bigstring(value val_buf1, value val_ofs1, value val_buf2,
          Long_val(val_len));
   return Val_unit;
 }
+
+/* Single loads and stores, fill, compare and byte search on bigstrings.
+ * None of these allocate (except the uint64 loads, which box their
+ * result) or raise, so they need no local roots and the OCaml side can
+ * declare them "noalloc".  Offsets are not bounds-checked here. */
+
+#define Ba_ptr(v_ba, v_ofs) ((unsigned char *)Caml_ba_data_val(v_ba) + Long_val(v_ofs))
+
+static inline uint16_t
+load16(const unsigned char *p)
+{
+  uint16_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static inline uint32_t
+load32(const unsigned char *p)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static inline uint64_t
+load64(const unsigned char *p)
+{
+  uint64_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+#define store16(p, x) do { uint16_t _x = (x); memcpy((p), &_x, sizeof(_x)); } while (0)
+#define store32(p, x) do { uint32_t _x = (x); memcpy((p), &_x, sizeof(_x)); } while (0)
+#define store64(p, x) do { uint64_t _x = (x); memcpy((p), &_x, sizeof(_x)); } while (0)
+
+/* x86_64 is little-endian, so only big-endian accesses swap */
+#define le16(x) (x)
+#define le32(x) (x)
+#define le64(x) (x)
+#define be16(x) __builtin_bswap16(x)
+#define be32(x) __builtin_bswap32(x)
+#define be64(x) __builtin_bswap64(x)
+
+CAMLprim value
+caml_bigstring_get_uint8(value v_ba, value v_ofs)
+{
+  return Val_int(*Ba_ptr(v_ba, v_ofs));
+}
+
+CAMLprim value
+caml_bigstring_set_uint8(value v_ba, value v_ofs, value v_x)
+{
+  *Ba_ptr(v_ba, v_ofs) = Int_val(v_x);
+  return Val_unit;
+}
+
+#define ACCESSORS(bits, end)                                                \
+CAMLprim value                                                              \
+caml_bigstring_get_uint##bits##_##end(value v_ba, value v_ofs)              \
+{                                                                           \
+  return Val_long(end##bits(load##bits(Ba_ptr(v_ba, v_ofs))));              \
+}                                                                           \
+                                                                            \
+CAMLprim value                                                              \
+caml_bigstring_set_uint##bits##_##end(value v_ba, value v_ofs, value v_x)  \
+{                                                                           \
+  store##bits(Ba_ptr(v_ba, v_ofs), end##bits((uint##bits##_t)Long_val(v_x))); \
+  return Val_unit;                                                          \
+}
+
+ACCESSORS(16, le)
+ACCESSORS(16, be)
+ACCESSORS(32, le)
+ACCESSORS(32, be)
+
+CAMLprim value
+caml_bigstring_get_uint64_le(value v_ba, value v_ofs)
+{
+  return caml_copy_int64(le64(load64(Ba_ptr(v_ba, v_ofs))));
+}
+
+CAMLprim value
+caml_bigstring_get_uint64_be(value v_ba, value v_ofs)
+{
+  return caml_copy_int64(be64(load64(Ba_ptr(v_ba, v_ofs))));
+}
+
+CAMLprim value
+caml_bigstring_set_uint64_le(value v_ba, value v_ofs, value v_x)
+{
+  store64(Ba_ptr(v_ba, v_ofs), le64((uint64_t)Int64_val(v_x)));
+  return Val_unit;
+}
+
+CAMLprim value
+caml_bigstring_set_uint64_be(value v_ba, value v_ofs, value v_x)
+{
+  store64(Ba_ptr(v_ba, v_ofs), be64((uint64_t)Int64_val(v_x)));
+  return Val_unit;
+}
+
+CAMLprim value
+caml_bigstring_fill(value v_ba, value v_ofs, value v_len, value v_c)
+{
+  memset(Ba_ptr(v_ba, v_ofs), Int_val(v_c), Long_val(v_len));
+  return Val_unit;
+}
+
+/* Returns the sign of the first differing byte, as compare does */
+CAMLprim value
+caml_bigstring_compare(value v_ba1, value v_ofs1, value v_ba2, value v_ofs2, value v_len)
+{
+  int r = memcmp(Ba_ptr(v_ba1, v_ofs1), Ba_ptr(v_ba2, v_ofs2), Long_val(v_len));
+  return Val_int((r > 0) - (r < 0));
+}
+
+/* Returns the offset of the first [c] in the range, or -1 */
+CAMLprim value
+caml_bigstring_index(value v_ba, value v_ofs, value v_len, value v_c)
+{
+  unsigned char *base = Caml_ba_data_val(v_ba);
+  unsigned char *p = memchr(Ba_ptr(v_ba, v_ofs), Int_val(v_c), Long_val(v_len));
+  return Val_long(p ? p - base : -1);
+}
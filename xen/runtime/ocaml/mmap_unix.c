@@ -188,9 +188,9 @@ CAMLprim value caml_ba_map_file_bytecode(value * argv, int argn)
                           argv[3], argv[4], argv[5]);
 }
 
+#if defined(HAS_MMAP)
 void caml_ba_unmap_file(void * addr, uintnat len)
 {
-#if defined(HAS_MMAP)
   uintnat page = getpagesize();
   uintnat delta = (uintnat) addr % page;
   if (len == 0) return;         /* PR#5463 */
@@ -200,5 +200,11 @@ void caml_ba_unmap_file(void * addr, uintnat len)
   msync(addr, len, MS_ASYNC);   /* PR#3571 */
 #endif
   munmap(addr, len);
-#endif
 }
+#else
+/* Without mmap, the kernel provides caml_ba_unmap_file to release
+   Io_page arrays: caml_alloc_pages in kernel/page_stubs.c flags them
+   CAML_BA_MAPPED_FILE so that the bigarray finaliser calls it. HAS_MMAP
+   must therefore stay undefined in this runtime, or this file's
+   munmap would be called on pool pages instead. */
+#endif